@@ -7,6 +7,7 @@
 #include "emoji_suggestions.h"
 
 #include <algorithm>
+#include <mutex>
 #include "emoji_suggestions_data.h"
 
 #ifndef Expects
@@ -108,6 +109,8 @@ class Completer {
 public:
 	Completer(utf16string query);
 
+	static std::vector<utf16char> NormalizeQuery(utf16string query);
+
 	std::vector<Suggestion> resolve();
 
 private:
@@ -116,7 +119,6 @@ private:
 		int wordsUsed;
 	};
 
-	static std::vector<utf16char> NormalizeQuery(utf16string query);
 	void addResult(const Replacement *replacement);
 	bool isDuplicateOfLastResult(const Replacement *replacement) const;
 	bool isBetterThanLastResult(const Replacement *replacement) const;
@@ -419,10 +421,321 @@ string_span Completer::findWordsStartingWith(utf16char ch) {
 		end - begin);
 }
 
+// Short queries have the largest buckets and repeat most often.
+constexpr auto kCachedQueries = 64;
+constexpr auto kCachedQueryLength = 4;
+
+struct CachedQuery {
+	std::vector<utf16char> query;
+	std::vector<Suggestion> result;
+};
+
+std::vector<Suggestion> ResolveCached(utf16string query) {
+	if (query.size() > kCachedQueryLength) {
+		return Completer(query).resolve();
+	}
+	static auto Mutex = std::mutex();
+	static auto Cache = std::vector<CachedQuery>();
+
+	auto key = std::vector<utf16char>(query.data(), query.data() + query.size());
+	{
+		auto lock = std::lock_guard<std::mutex>(Mutex);
+		const auto i = std::find_if(Cache.begin(), Cache.end(), [&](const CachedQuery &cached) {
+			return (cached.query == key);
+		});
+		if (i != Cache.end()) {
+			// Most recently used queries are kept at the end.
+			std::rotate(i, i + 1, Cache.end());
+			return Cache.back().result;
+		}
+	}
+	auto result = Completer(query).resolve();
+	auto lock = std::lock_guard<std::mutex>(Mutex);
+	if (Cache.size() >= kCachedQueries) {
+		Cache.erase(Cache.begin(), Cache.end() - kCachedQueries + 1);
+	}
+	Cache.push_back({ std::move(key), result });
+	return result;
+}
+
+// Every replacement once, shortest first.
+const std::vector<const Replacement*> &AllReplacements() {
+	static const auto result = [] {
+		auto result = std::vector<const Replacement*>();
+		for (const auto ch : "abcdefghijklmnopqrstuvwxyz0123456789-+") {
+			if (!ch) {
+				break;
+			} else if (const auto list = internal::GetReplacements(ch)) {
+				result.insert(result.end(), list->begin(), list->end());
+			}
+		}
+		std::sort(result.begin(), result.end());
+		result.erase(std::unique(result.begin(), result.end()), result.end());
+		std::stable_sort(result.begin(), result.end(), [](
+				const Replacement *a,
+				const Replacement *b) {
+			return a->replacement.size() < b->replacement.size();
+		});
+		return result;
+	}();
+	return result;
+}
+
+bool StartsWith(const utf16char *text, int size, const utf16char *prefix, int length) {
+	return (size >= length)
+		&& (!length || !memcmp(text, prefix, length * sizeof(utf16char)));
+}
+
+bool StartsWith(utf16string text, const std::vector<utf16char> &prefix) {
+	return StartsWith(text.data(), int(text.size()), prefix.data(), int(prefix.size()));
+}
+
+bool IsLess(utf16string a, utf16string b) {
+	const auto common = int(std::min(a.size(), b.size()));
+	for (auto i = 0; i != common; ++i) {
+		if (a[i] != b[i]) {
+			return (a[i] < b[i]);
+		}
+	}
+	return (a.size() < b.size());
+}
+
+// Longer queries are checked against the whole keyword.
+constexpr auto kIndexedPrefixLength = 4;
+
+struct PrefixEntry {
+	utf16string word;
+	int length = 0;
+	int rank = 0;
+	const Replacement *replacement = nullptr;
+
+	utf16string prefix() const {
+		return utf16string(word.data(), length);
+	}
+};
+
+// Short prefixes of all keywords, each with the replacements having it,
+// in the order Completer gives to matches of a single keyword: ones with
+// a single keyword first, then ones starting with the query character,
+// then by the position in the first character bucket.
+const std::vector<PrefixEntry> &Prefixes() {
+	static const auto result = [] {
+		auto result = std::vector<PrefixEntry>();
+		for (const auto ch : "abcdefghijklmnopqrstuvwxyz0123456789-+") {
+			if (!ch) {
+				break;
+			}
+			const auto list = internal::GetReplacements(ch);
+			if (!list) {
+				continue;
+			}
+			for (auto position = 0, count = int(list->size()); position != count; ++position) {
+				const auto item = (*list)[position];
+				// One character queries don't count the keywords used.
+				const auto single = ((item->replacement[1] != utf16char(ch)) ? (1 << 20) : 0)
+					| position;
+				const auto rank = ((item->words.size() > 1) ? (1 << 21) : 0)
+					| single;
+				for (const auto word : item->words) {
+					if (!word.size() || word[0] != utf16char(ch)) {
+						continue;
+					}
+					const auto till = std::min(int(word.size()), kIndexedPrefixLength);
+					for (auto length = 1; length <= till; ++length) {
+						result.push_back({ word, length, (length > 1) ? rank : single, item });
+					}
+				}
+			}
+		}
+		std::sort(result.begin(), result.end(), [](const PrefixEntry &a, const PrefixEntry &b) {
+			return IsLess(a.prefix(), b.prefix())
+				|| (!IsLess(b.prefix(), a.prefix()) && (a.rank < b.rank));
+		});
+		return result;
+	}();
+	return result;
+}
+
+// Replacements sorted by their text, for the exact match lookup.
+const std::vector<const Replacement*> &ByText() {
+	static const auto result = [] {
+		auto result = AllReplacements();
+		std::sort(result.begin(), result.end(), [](
+				const Replacement *a,
+				const Replacement *b) {
+			return IsLess(a->replacement, b->replacement);
+		});
+		return result;
+	}();
+	return result;
+}
+
+void AppendUnique(std::vector<Suggestion> &result, const Replacement *item) {
+	const auto duplicate = std::any_of(result.begin(), result.end(), [&](const Suggestion &suggestion) {
+		return (suggestion.emoji() == item->emoji);
+	});
+	if (!duplicate) {
+		result.emplace_back(item->emoji, item->replacement, item->replacement);
+	}
+}
+
+// Completer puts the replacement equal to the query and one more
+// character, the closing colon, before everything else.
+void AppendExact(std::vector<Suggestion> &result, utf16string query) {
+	const auto &list = ByText();
+	const auto size = query.size();
+	auto i = std::lower_bound(list.begin(), list.end(), query, [](const Replacement *item, utf16string query) {
+		return IsLess(item->replacement, query);
+	});
+	for (; i != list.end(); ++i) {
+		const auto text = (*i)->replacement;
+		if (text.size() < size || !(utf16string(text.data(), size) == query)) {
+			break;
+		} else if (text.size() == size + 1) {
+			AppendUnique(result, *i);
+		}
+	}
+}
+
+// Replacements with a keyword starting with the query, in rank order,
+// stopping as soon as there are enough of them.
+void AppendByPrefix(std::vector<Suggestion> &result, const std::vector<utf16char> &query, std::size_t limit) {
+	const auto &list = Prefixes();
+	const auto key = utf16string(query.data(), std::min(int(query.size()), kIndexedPrefixLength));
+	auto i = std::lower_bound(list.begin(), list.end(), key, [](const PrefixEntry &entry, utf16string key) {
+		return IsLess(entry.prefix(), key);
+	});
+	for (; i != list.end() && i->prefix() == key && result.size() < limit; ++i) {
+		if (query.size() == key.size() || StartsWith(i->word, query)) {
+			AppendUnique(result, i->replacement);
+		}
+	}
+}
+
+struct FuzzyEntry {
+	utf16char key = 0;
+	utf16string word;
+	int rank = 0; // Index in AllReplacements().
+};
+
+// A word with a prefix at edit distance one from a query of two or more
+// characters starts with one of the first two query characters or has
+// one of them as its second character. All keywords are indexed by both.
+struct FuzzyIndex {
+	std::vector<FuzzyEntry> byFirst;
+	std::vector<FuzzyEntry> bySecond;
+};
+
+const FuzzyIndex &Fuzzy() {
+	static const auto result = [] {
+		auto result = FuzzyIndex();
+		const auto &all = AllReplacements();
+		for (auto rank = 0, count = int(all.size()); rank != count; ++rank) {
+			for (const auto word : all[rank]->words) {
+				if (word.size() > 0) {
+					result.byFirst.push_back({ word[0], word, rank });
+				}
+				if (word.size() > 1) {
+					result.bySecond.push_back({ word[1], word, rank });
+				}
+			}
+		}
+		const auto byKey = [](const FuzzyEntry &a, const FuzzyEntry &b) {
+			return (a.key < b.key);
+		};
+		std::stable_sort(result.byFirst.begin(), result.byFirst.end(), byKey);
+		std::stable_sort(result.bySecond.begin(), result.bySecond.end(), byKey);
+		return result;
+	}();
+	return result;
+}
+
+
+// If some prefix of the text is at Levenshtein distance one from query.
+bool StartsWithOneEdit(utf16string text, const std::vector<utf16char> &query) {
+	const auto t = text.data();
+	const auto q = query.data();
+	const auto size = int(text.size());
+	const auto length = int(query.size());
+	auto mismatch = 0;
+	while (mismatch != length && mismatch != size && t[mismatch] == q[mismatch]) {
+		++mismatch;
+	}
+	if (mismatch == length) {
+		return false; // Exact prefix, not a fuzzy match.
+	}
+	const auto k = mismatch;
+	return StartsWith(t + k + 1, size - k - 1, q + k + 1, length - k - 1) // Substitution.
+		|| StartsWith(t + k, size - k, q + k + 1, length - k - 1) // Extra char in query.
+		|| StartsWith(t + k + 1, size - k - 1, q + k, length - k); // Missing char in query.
+}
+
+void AppendFuzzy(std::vector<Suggestion> &result, utf16string query, std::size_t limit) {
+	const auto normalized = Completer::NormalizeQuery(query);
+	if (normalized.size() < 2) {
+		return;
+	}
+	const auto &index = Fuzzy();
+	auto ranks = std::vector<int>();
+	const auto collect = [&](const std::vector<FuzzyEntry> &entries, utf16char key) {
+		const auto range = std::equal_range(entries.begin(), entries.end(), FuzzyEntry{ key }, [](const FuzzyEntry &a, const FuzzyEntry &b) {
+			return (a.key < b.key);
+		});
+		for (auto i = range.first; i != range.second; ++i) {
+			if (StartsWithOneEdit(i->word, normalized)) {
+				ranks.push_back(i->rank);
+			}
+		}
+	};
+	for (const auto key : { normalized[0], normalized[1] }) {
+		collect(index.byFirst, key);
+		collect(index.bySecond, key);
+	}
+	std::sort(ranks.begin(), ranks.end());
+	ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+
+	const auto &all = AllReplacements();
+	for (const auto rank : ranks) {
+		if (result.size() >= limit) {
+			break;
+		}
+		AppendUnique(result, all[rank]);
+	}
+}
+
 } // namespace
 
 std::vector<Suggestion> GetSuggestions(utf16string query) {
-	return Completer(query).resolve();
+	return ResolveCached(query);
+}
+
+std::vector<Suggestion> GetSuggestions(utf16string query, std::size_t limit, bool fuzzy) {
+	const auto normalized = Completer::NormalizeQuery(query);
+	if (normalized.empty() || !limit) {
+		return std::vector<Suggestion>();
+	}
+	auto result = std::vector<Suggestion>();
+	AppendExact(result, query);
+	AppendByPrefix(result, normalized, limit);
+	if (result.size() < limit) {
+		// Few single keyword matches, add the ones spanning several keywords.
+		for (const auto &suggestion : ResolveCached(query)) {
+			if (result.size() >= limit) {
+				break;
+			}
+			const auto emoji = suggestion.emoji();
+			const auto duplicate = std::any_of(result.begin(), result.end(), [&](const Suggestion &existing) {
+				return (existing.emoji() == emoji);
+			});
+			if (!duplicate) {
+				result.push_back(suggestion);
+			}
+		}
+	}
+	if (fuzzy && result.size() < limit) {
+		AppendFuzzy(result, query, limit);
+	}
+	return result;
 }
 
 int GetSuggestionMaxLength() {
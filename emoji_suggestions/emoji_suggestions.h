@@ -82,6 +82,14 @@ private:
 
 std::vector<Suggestion> GetSuggestions(utf16string query);
 
+// At most limit results, taken from a prefix index in rank order without
+// resolving the whole list: the exact replacement, then the ones with a
+// keyword starting with the query, ordered as GetSuggestions(query) does.
+// Only if there are fewer, matches spanning several keywords are added.
+// With fuzzy, if there are still fewer, adds replacements starting at
+// edit distance one from the query.
+std::vector<Suggestion> GetSuggestions(utf16string query, std::size_t limit, bool fuzzy = false);
+
 inline utf16string GetSuggestionEmoji(utf16string replacement) {
 	return internal::GetReplacementEmoji(replacement);
 }
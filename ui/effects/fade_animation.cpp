@@ -34,7 +34,7 @@ void FadeAnimation::setOpacity(float64 opacity) {
 			}
 		} else {
 			if (!_cache.isNull()) {
-				_cache = QPixmap();
+				ReturnSnapshot(base::take(_cache));
 			}
 		}
 	}
@@ -77,7 +77,7 @@ bool FadeAnimation::paint(QPainter &p) {
 
 void FadeAnimation::refreshCache() {
 	if (!_cache.isNull()) {
-		_cache = QPixmap();
+		ReturnSnapshot(base::take(_cache));
 		_cache = grabContent();
 		Assert(!_cache.isNull());
 	}
@@ -130,7 +130,7 @@ void FadeAnimation::hide() {
 void FadeAnimation::stopAnimation() {
 	_animation.stop();
 	if (!_cache.isNull() && (!_visible || _opacity >= 1.)) {
-		_cache = QPixmap();
+		ReturnSnapshot(base::take(_cache));
 		if (_finishedCallback) {
 			_finishedCallback();
 		}
@@ -168,6 +168,10 @@ void RoundShadowAnimation::paintShadowTile(
 			const auto shadowAlpha = (std::max(
 				_frameAlpha - int(source >> 24),
 				0) * opacityScale) >> 8;
+			if (!shadowAlpha) {
+				// Under an opaque part of the frame nothing changes.
+				continue;
+			}
 			frameRow[x] = anim::unshifted(
 				anim::shifted(source) * 256
 				+ anim::shifted(shadowPixel) * shadowAlpha);
@@ -176,6 +180,10 @@ void RoundShadowAnimation::paintShadowTile(
 	}
 }
 
+PanelAnimation::~PanelAnimation() {
+	ReturnSnapshot(std::move(_finalImage));
+}
+
 void PanelAnimation::setFinalImage(
 		QImage &&finalImage,
 		QRect inner,
@@ -185,11 +193,11 @@ void PanelAnimation::setFinalImage(
 	_cornerRadius = cornerRadius;
 
 	const auto pixelRatio = style::DevicePixelRatio();
-	_finalImage = PixmapFromImage(
-		std::move(finalImage).convertToFormat(
-			QImage::Format_ARGB32_Premultiplied));
+	_finalImage = std::move(finalImage).convertToFormat(
+		QImage::Format_ARGB32_Premultiplied);
 
 	Assert(!_finalImage.isNull());
+	Assert(_finalImage.depth() == static_cast<int>(sizeof(uint32) << 3));
 	_finalWidth = _finalImage.width();
 	_finalHeight = _finalImage.height();
 	Assert(!(_finalWidth % pixelRatio));
@@ -258,25 +266,24 @@ void PanelAnimation::createFadeMask() {
 	}
 	auto finalAlpha = qRound(_st.fadeOpacity * 255);
 	Assert(finalAlpha >= 0 && finalAlpha < 256);
-	auto result = QImage(style::DevicePixelRatio(), resultHeight, QImage::Format_ARGB32_Premultiplied);
-	auto ints = reinterpret_cast<uint32*>(result.bits());
-	auto intsPerLineAdded = (result.bytesPerLine() >> 2) - style::DevicePixelRatio();
 	auto up = (_origin == PanelAnimation::Origin::BottomLeft || _origin == PanelAnimation::Origin::BottomRight);
 	auto from = up ? resultHeight : 0, to = resultHeight - from, delta = up ? -1 : 1;
 	auto fadeFirstAlpha = up ? (finalAlpha + 1) : 1;
 	auto fadeLastAlpha = up ? 1 : (finalAlpha + 1);
-	_fadeFirst = QBrush(QColor(_st.fadeBg->c.red(), _st.fadeBg->c.green(), _st.fadeBg->c.blue(), (_st.fadeBg->c.alpha() * fadeFirstAlpha) >> 8));
-	_fadeLast = QBrush(QColor(_st.fadeBg->c.red(), _st.fadeBg->c.green(), _st.fadeBg->c.blue(), (_st.fadeBg->c.alpha() * fadeLastAlpha) >> 8));
+	const auto &c = _st.fadeBg->c;
+	_fadeFirst = anim::getPremultiplied(QColor(c.red(), c.green(), c.blue(), (c.alpha() * fadeFirstAlpha) >> 8));
+	_fadeLast = anim::getPremultiplied(QColor(c.red(), c.green(), c.blue(), (c.alpha() * fadeLastAlpha) >> 8));
+
+	// Each line of the fade has a single color, the frame is as wide as
+	// the final image, so keep only one premultiplied pixel for a line.
+	const auto pattern = anim::shifted(c);
+	_fadeColors.clear();
+	_fadeColors.reserve(resultHeight);
 	for (auto y = from; y != to; y += delta) {
 		auto alpha = static_cast<uint32>(finalAlpha * y) / resultHeight;
-		auto value = (0xFFU << 24) | (alpha << 16) | (alpha << 8) | alpha;
-		for (auto x = 0; x != style::DevicePixelRatio(); ++x) {
-			*ints++ = value;
-		}
-		ints += intsPerLineAdded;
+		_fadeColors.push_back(anim::unshifted(pattern * (alpha + 1)));
 	}
-	_fadeMask = PixmapFromImage(style::colorizeImage(result, _st.fadeBg));
-	_fadeHeight = _fadeMask.height();
+	_fadeHeight = resultHeight;
 }
 
 void PanelAnimation::setSkipShadow(bool skipShadow) {
@@ -349,6 +356,54 @@ auto PanelAnimation::computeState(float64 dt, float64 opacity) const
 	};
 }
 
+void PanelAnimation::paintContent(
+		QRect frame,
+		int fadeTop,
+		int fadeBottom,
+		int fadeSkipLines,
+		float64 opacity) {
+	const auto opacity256 = anim::interpolate(0, 256, opacity);
+	const auto width = frame.width();
+	const auto imageInts = reinterpret_cast<const uint32*>(
+		_finalImage.constBits());
+	const auto imageIntsPerLine = (_finalImage.bytesPerLine() >> 2);
+	auto imageRow = imageInts
+		+ frame.y() * imageIntsPerLine
+		+ frame.x();
+	auto frameRow = _frameInts + frame.y() * _frameIntsPerLine + frame.x();
+	for (auto y = frame.y(); y != frame.y() + frame.height(); ++y) {
+		const auto fade = !_fadeHeight
+			? 0U
+			: (y < fadeTop)
+			? _fadeFirst
+			: (y < fadeBottom)
+			? _fadeColors[y - fadeTop + fadeSkipLines]
+			: _fadeLast;
+
+		// Same as drawing the image with the opacity on transparent
+		// and filling the line with the fade color over it.
+		const auto color = (opacity256 == 256)
+			? fade
+			: anim::unshifted(anim::shifted(fade) * opacity256);
+		const auto colorAlpha = int(color >> 24);
+		if (!color && opacity256 == 256) {
+			memcpy(frameRow, imageRow, width * sizeof(uint32));
+		} else if (colorAlpha == 255 || !opacity256) {
+			std::fill(frameRow, frameRow + width, color);
+		} else {
+			const auto multiplier = anim::ShiftedMultiplier(
+				(opacity256 * (255 - colorAlpha)) / 255);
+			const auto added = anim::shifted(color) * 256;
+			for (auto x = 0; x != width; ++x) {
+				frameRow[x] = anim::unshifted(
+					anim::shifted(imageRow[x]) * multiplier + added);
+			}
+		}
+		imageRow += imageIntsPerLine;
+		frameRow += _frameIntsPerLine;
+	}
+}
+
 auto PanelAnimation::paintFrame(
 	QPainter &p,
 	int x,
@@ -387,30 +442,12 @@ auto PanelAnimation::paintFrame(
 	fadeTop += frameTop;
 	fadeBottom += frameTop;
 
-	if (opacity < 1.) {
-		_frame.fill(Qt::transparent);
-	}
-	{
-		QPainter p(&_frame);
-		p.setOpacity(opacity);
-		auto painterFrameLeft = frameLeft / pixelRatio;
-		auto painterFrameTop = frameTop / pixelRatio;
-		auto painterFadeBottom = fadeBottom / pixelRatio;
-		p.drawPixmap(painterFrameLeft, painterFrameTop, _finalImage, frameLeft, frameTop, frameWidth, frameHeight);
-		if (_fadeHeight) {
-			if (frameTop != fadeTop) {
-				p.fillRect(painterFrameLeft, painterFrameTop, frameWidth, fadeTop - frameTop, _fadeFirst);
-			}
-			if (fadeTop != fadeBottom) {
-				auto painterFadeTop = fadeTop / pixelRatio;
-				auto painterFrameWidth = frameWidth / pixelRatio;
-				p.drawPixmap(painterFrameLeft, painterFadeTop, painterFrameWidth, painterFadeBottom - painterFadeTop, _fadeMask, 0, fadeSkipLines, pixelRatio, fadeBottom - fadeTop);
-			}
-			if (fadeBottom != frameBottom) {
-				p.fillRect(painterFrameLeft, painterFadeBottom, frameWidth, frameBottom - fadeBottom, _fadeLast);
-			}
-		}
-	}
+	paintContent(
+		QRect(frameLeft, frameTop, frameWidth, frameHeight),
+		fadeTop,
+		fadeBottom,
+		fadeSkipLines,
+		opacity);
 
 	// Draw corners
 	paintCorner(_topLeft, frameLeft, frameTop);
@@ -444,34 +481,29 @@ auto PanelAnimation::paintFrame(
 		}
 	}
 
-	if (opacity == 1.) {
-		// Fill above the frame top with transparent.
-		auto fillTopInts = (_frameInts + outerTop * _frameIntsPerLine + outerLeft);
-		auto fillWidth = (outerRight - outerLeft) * sizeof(uint32);
-		for (auto fillTop = frameTop - outerTop; fillTop != 0; --fillTop) {
-			memset(fillTopInts, 0, fillWidth);
-			fillTopInts += _frameIntsPerLine;
-		}
-
-		// Fill to the left and to the right of the frame with transparent.
-		auto fillLeft = (frameLeft - outerLeft) * sizeof(uint32);
-		auto fillRight = (outerRight - frameRight) * sizeof(uint32);
-		if (fillLeft || fillRight) {
-			auto fillInts = _frameInts + frameTop * _frameIntsPerLine;
-			for (auto y = frameTop; y != frameBottom; ++y) {
-				memset(fillInts + outerLeft, 0, fillLeft);
-				memset(fillInts + frameRight, 0, fillRight);
-				fillInts += _frameIntsPerLine;
-			}
-		}
-
-		// Fill below the frame bottom with transparent.
-		auto fillBottomInts = (_frameInts + frameBottom * _frameIntsPerLine + outerLeft);
-		for (auto fillBottom = outerBottom - frameBottom; fillBottom != 0; --fillBottom) {
-			memset(fillBottomInts, 0, fillWidth);
-			fillBottomInts += _frameIntsPerLine;
+	// Fill around the frame with transparent, the shadow is blended there.
+	// The frame itself is fully overwritten by paintContent().
+	auto fillTopInts = (_frameInts + outerTop * _frameIntsPerLine + outerLeft);
+	auto fillWidth = (outerRight - outerLeft) * sizeof(uint32);
+	for (auto fillTop = frameTop - outerTop; fillTop != 0; --fillTop) {
+		memset(fillTopInts, 0, fillWidth);
+		fillTopInts += _frameIntsPerLine;
+	}
+	auto fillLeft = (frameLeft - outerLeft) * sizeof(uint32);
+	auto fillRight = (outerRight - frameRight) * sizeof(uint32);
+	if (fillLeft || fillRight) {
+		auto fillInts = _frameInts + frameTop * _frameIntsPerLine;
+		for (auto y = frameTop; y != frameBottom; ++y) {
+			memset(fillInts + outerLeft, 0, fillLeft);
+			memset(fillInts + frameRight, 0, fillRight);
+			fillInts += _frameIntsPerLine;
 		}
 	}
+	auto fillBottomInts = (_frameInts + frameBottom * _frameIntsPerLine + outerLeft);
+	for (auto fillBottom = outerBottom - frameBottom; fillBottom != 0; --fillBottom) {
+		memset(fillBottomInts, 0, fillWidth);
+		fillBottomInts += _frameIntsPerLine;
+	}
 
 	if (_shadow.valid()) {
 		paintShadow(outerLeft, outerTop, outerRight, outerBottom);
@@ -85,6 +85,7 @@ public:
 	};
 	PanelAnimation(const style::PanelAnimation &st, Origin origin) : _st(st), _origin(origin) {
 	}
+	~PanelAnimation();
 
 	struct PaintState {
 		float64 opacity = 0.;
@@ -114,6 +115,12 @@ private:
 	void setStartAlpha();
 	void setStartFadeTop();
 	void createFadeMask();
+	void paintContent(
+		QRect frame,
+		int fadeTop,
+		int fadeBottom,
+		int fadeSkipLines,
+		float64 opacity);
 	void setWidthDuration();
 	void setHeightDuration();
 	void setAlphaDuration();
@@ -121,7 +128,7 @@ private:
 	const style::PanelAnimation &_st;
 	Origin _origin = Origin::TopLeft;
 
-	QPixmap _finalImage;
+	QImage _finalImage;
 	int _finalWidth = 0;
 	int _finalHeight = 0;
 	int _finalInnerLeft = 0;
@@ -138,9 +145,10 @@ private:
 	int _startAlpha = 0;
 
 	int _startFadeTop = 0;
-	QPixmap _fadeMask;
+	std::vector<uint32> _fadeColors;
 	int _fadeHeight = 0;
-	QBrush _fadeFirst, _fadeLast;
+	uint32 _fadeFirst = 0;
+	uint32 _fadeLast = 0;
 
 	float64 _widthDuration = 1.;
 	float64 _heightDuration = 1.;
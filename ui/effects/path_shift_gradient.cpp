@@ -8,6 +8,10 @@
 
 #include "base/call_delayed.h"
 #include "ui/effects/animations.h"
+#include "ui/style/style_core.h"
+#include "ui/style/style_core_scale.h"
+
+#include <QtGui/QPainter>
 
 namespace Ui {
 namespace {
@@ -15,6 +19,73 @@ namespace {
 constexpr auto kSlideDuration = crl::time(1000);
 constexpr auto kWaitDuration = crl::time(1000);
 constexpr auto kFullDuration = kSlideDuration + kWaitDuration;
+constexpr auto kStripsCached = 8;
+
+// One row of the whole path: the gradient, then the background for the
+// viewport width and one more gradient width. Tiled from the gradient
+// start it covers the viewport at any moment of the slide.
+[[nodiscard]] QBrush StripBrush(
+		const QGradientStops &stops,
+		int viewportWidth,
+		int gradientWidth) {
+	struct Cached {
+		QRgb bg = 0;
+		QRgb fg = 0;
+		int viewportWidth = 0;
+		int gradientWidth = 0;
+		int ratio = 0;
+		QBrush brush;
+	};
+	// Leaked, so that the textures are never destroyed after the
+	// application during the static destruction.
+	static const auto Strips = new std::vector<Cached>();
+	static auto StripsPaletteVersion = style::PaletteVersion();
+	auto &cache = *Strips;
+	if (StripsPaletteVersion != style::PaletteVersion()) {
+		// Strips of the previous palette colors won't be used again.
+		StripsPaletteVersion = style::PaletteVersion();
+		cache.clear();
+	}
+
+	const auto bg = stops.front().second;
+	const auto fg = stops[stops.size() / 2].second;
+	const auto ratio = style::DevicePixelRatio();
+	const auto i = ranges::find_if(cache, [&](const Cached &cached) {
+		return (cached.bg == bg.rgba())
+			&& (cached.fg == fg.rgba())
+			&& (cached.viewportWidth == viewportWidth)
+			&& (cached.gradientWidth == gradientWidth)
+			&& (cached.ratio == ratio);
+	});
+	if (i != end(cache)) {
+		return i->brush;
+	}
+	const auto gradient = gradientWidth * ratio;
+	auto strip = QImage(
+		(viewportWidth + 2 * gradientWidth) * ratio,
+		1,
+		QImage::Format_ARGB32_Premultiplied);
+	strip.fill(bg);
+	{
+		auto p = QPainter(&strip);
+		auto linear = QLinearGradient(0, 0, gradient, 0);
+		linear.setStops(stops);
+		p.setCompositionMode(QPainter::CompositionMode_Source);
+		p.fillRect(0, 0, gradient, 1, QBrush(std::move(linear)));
+	}
+	if (cache.size() == kStripsCached) {
+		cache.erase(begin(cache));
+	}
+	cache.push_back({
+		.bg = bg.rgba(),
+		.fg = fg.rgba(),
+		.viewportWidth = viewportWidth,
+		.gradientWidth = gradientWidth,
+		.ratio = ratio,
+		.brush = QBrush(std::move(strip)),
+	});
+	return cache.back().brush;
+}
 
 } // namespace
 
@@ -114,6 +185,34 @@ bool PathShiftGradient::paint(Fn<bool(const Background&)> painter) {
 	return true;
 }
 
+bool PathShiftGradient::paintShared(Fn<bool(const QBrush&)> painter) {
+	updateGeometry();
+	const auto brush = (_gradientEnabled && _gradientWidth > 0)
+		? sharedBrush()
+		: _gradientEnabled
+		? QBrush(_gradient.stops().front().second)
+		: _bgOverride
+		? QBrush((*_bgOverride)->c)
+		: QBrush(_bg->c);
+	if (!painter(brush)) {
+		return false;
+	}
+	activateAnimation();
+	return true;
+}
+
+QBrush PathShiftGradient::sharedBrush() const {
+	const auto ratio = style::DevicePixelRatio();
+	auto result = StripBrush(
+		_gradient.stops(),
+		_viewportWidth,
+		_gradientWidth);
+	result.setTransform(QTransform::fromTranslate(
+		_gradientStart,
+		0).scale(1. / ratio, 1. / ratio));
+	return result;
+}
+
 void PathShiftGradient::activateAnimation() {
 	if (_animationActive) {
 		return;
@@ -32,6 +32,10 @@ public:
 	using Background = std::variant<QLinearGradient*, style::color>;
 	bool paint(Fn<bool(const Background&)> painter);
 
+	// The moving gradient comes as a transformed texture brush, shared
+	// between all the instances with the same colors and geometry.
+	bool paintShared(Fn<bool(const QBrush&)> painter);
+
 private:
 	struct AnimationData;
 
@@ -39,6 +43,7 @@ private:
 	void refreshColors(const style::color &bg, const style::color &fg);
 	void updateGeometry();
 	void activateAnimation();
+	[[nodiscard]] QBrush sharedBrush() const;
 
 	static std::weak_ptr<AnimationData> Animation;
 
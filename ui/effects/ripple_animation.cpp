@@ -13,6 +13,100 @@
 #include "styles/style_widgets.h"
 
 namespace Ui {
+namespace {
+
+constexpr auto kMasksCached = 16;
+constexpr auto kFramesPooled = 4;
+
+enum class MaskType : uchar {
+	Rect,
+	RoundRect,
+	Ellipse,
+};
+
+struct CachedMask {
+	MaskType type = MaskType::Rect;
+	QSize size;
+	int radius = 0;
+	int ratio = 0;
+	QImage image;
+	QPixmap pixmap;
+};
+
+[[nodiscard]] std::vector<CachedMask> &Masks() {
+	static const auto result = new std::vector<CachedMask>();
+	return *result;
+}
+
+[[nodiscard]] std::vector<QImage> &Frames() {
+	static const auto result = new std::vector<QImage>();
+	return *result;
+}
+
+[[nodiscard]] QImage CachedMaskImage(
+		MaskType type,
+		QSize size,
+		int radius,
+		Fn<QImage()> generate) {
+	auto &masks = Masks();
+	const auto ratio = style::DevicePixelRatio();
+	const auto i = ranges::find_if(masks, [&](const CachedMask &mask) {
+		return (mask.type == type)
+			&& (mask.size == size)
+			&& (mask.radius == radius)
+			&& (mask.ratio == ratio);
+	});
+	if (i != end(masks)) {
+		return i->image;
+	}
+	if (masks.size() == kMasksCached) {
+		masks.erase(begin(masks));
+	}
+	masks.push_back({
+		.type = type,
+		.size = size,
+		.radius = radius,
+		.ratio = ratio,
+		.image = generate(),
+	});
+	return masks.back().image;
+}
+
+[[nodiscard]] CachedMask *FindCachedMask(const QImage &image) {
+	auto &masks = Masks();
+	const auto key = image.cacheKey();
+	const auto i = ranges::find_if(masks, [&](const CachedMask &mask) {
+		return (mask.image.cacheKey() == key);
+	});
+	return (i != end(masks)) ? &*i : nullptr;
+}
+
+[[nodiscard]] QImage TakeFrame(QSize size, float64 ratio) {
+	auto &frames = Frames();
+	const auto i = ranges::find_if(frames, [&](const QImage &frame) {
+		return (frame.size() == size)
+			&& (frame.devicePixelRatio() == ratio)
+			&& frame.isDetached();
+	});
+	if (i != end(frames)) {
+		auto result = std::move(*i);
+		frames.erase(i);
+		return result;
+	}
+	auto result = QImage(size, QImage::Format_ARGB32_Premultiplied);
+	result.setDevicePixelRatio(ratio);
+	return result;
+}
+
+void ReturnFrame(QImage &&frame) {
+	auto &frames = Frames();
+	if (frames.size() == kFramesPooled) {
+		frames.erase(begin(frames));
+	}
+	frames.push_back(std::move(frame));
+}
+
+} // namespace
 
 class RippleAnimation::Ripple {
 public:
@@ -26,11 +120,13 @@ public:
 		const style::RippleAnimation &st,
 		const QPixmap &mask,
 		Fn<void()> update);
+	~Ripple();
 
 	void paint(
 		QPainter &p,
 		const QPixmap &mask,
-		const QColor *colorOverride);
+		const QColor *colorOverride,
+		bool rectMask);
 
 	void stop();
 	void unstop();
@@ -41,6 +137,12 @@ public:
 	}
 
 private:
+	[[nodiscard]] int currentRadius() const;
+	void paintInRect(
+		QPainter &p,
+		const QPixmap &mask,
+		const QColor *colorOverride);
+
 	const style::RippleAnimation &_st;
 	Fn<void()> _update;
 
@@ -51,8 +153,8 @@ private:
 	bool _hiding = false;
 	Ui::Animations::Simple _show;
 	Ui::Animations::Simple _hide;
-	QPixmap _cache;
 	QImage _frame;
+	bool _cached = false;
 
 };
 
@@ -65,16 +167,13 @@ RippleAnimation::Ripple::Ripple(
 : _st(st)
 , _update(std::move(update))
 , _origin(origin)
-, _radiusFrom(startRadius)
-, _frame(mask.size(), QImage::Format_ARGB32_Premultiplied) {
-	_frame.setDevicePixelRatio(mask.devicePixelRatio());
-
+, _radiusFrom(startRadius) {
 	const auto pixelRatio = style::DevicePixelRatio();
 	QPoint points[] = {
 		{ 0, 0 },
-		{ _frame.width() / pixelRatio, 0 },
-		{ _frame.width() / pixelRatio, _frame.height() / pixelRatio },
-		{ 0, _frame.height() / pixelRatio },
+		{ mask.width() / pixelRatio, 0 },
+		{ mask.width() / pixelRatio, mask.height() / pixelRatio },
+		{ 0, mask.height() / pixelRatio },
 	};
 	for (auto point : points) {
 		accumulate_max(
@@ -92,34 +191,81 @@ RippleAnimation::Ripple::Ripple(const style::RippleAnimation &st, const QPixmap
 , _origin(
 	mask.width() / (2 * style::DevicePixelRatio()),
 	mask.height() / (2 * style::DevicePixelRatio()))
-, _radiusFrom(mask.width() + mask.height())
-, _frame(mask.size(), QImage::Format_ARGB32_Premultiplied) {
-	_frame.setDevicePixelRatio(mask.devicePixelRatio());
+, _radiusFrom(mask.width() + mask.height()) {
 	_radiusTo = _radiusFrom;
 	_hide.start(_update, 0., 1., _st.hideDuration);
 }
 
-void RippleAnimation::Ripple::paint(
+RippleAnimation::Ripple::~Ripple() {
+	if (!_frame.isNull()) {
+		ReturnFrame(std::move(_frame));
+	}
+}
+
+int RippleAnimation::Ripple::currentRadius() const {
+	const auto shown = _show.value(1.);
+	Assert(!std::isnan(shown));
+	const auto diff = float64(_radiusTo - _radiusFrom);
+	Assert(!std::isnan(diff));
+	const auto mult = diff * shown;
+	Assert(!std::isnan(mult));
+	const auto interpolated = _radiusFrom + mult;
+	//anim::interpolateF(_radiusFrom, _radiusTo, shown);
+	Assert(!std::isnan(interpolated));
+	return int(base::SafeRound(interpolated));
+	//anim::interpolate(_radiusFrom, _radiusTo, _show.value(1.));
+}
+
+void RippleAnimation::Ripple::paintInRect(
 		QPainter &p,
 		const QPixmap &mask,
 		const QColor *colorOverride) {
+	const auto ratio = style::DevicePixelRatio();
+	const auto rect = QRect(
+		0,
+		0,
+		mask.width() / ratio,
+		mask.height() / ratio);
+	const auto color = colorOverride ? *colorOverride : _st.color->c;
+	const auto radius = currentRadius();
+	if (radius >= _radiusTo) {
+		p.fillRect(rect, color);
+		return;
+	}
+	p.save();
+	p.setClipRect(rect, Qt::IntersectClip);
+	p.setPen(Qt::NoPen);
+	p.setBrush(color);
+	{
+		PainterHighQualityEnabler hq(p);
+		p.drawEllipse(_origin, radius, radius);
+	}
+	p.restore();
+}
+
+void RippleAnimation::Ripple::paint(
+		QPainter &p,
+		const QPixmap &mask,
+		const QColor *colorOverride,
+		bool rectMask) {
 	auto opacity = _hide.value(_hiding ? 0. : 1.);
 	if (opacity == 0.) {
 		return;
 	}
 
-	if (_cache.isNull() || colorOverride != nullptr) {
-		const auto shown = _show.value(1.);
-		Assert(!std::isnan(shown));
-		const auto diff = float64(_radiusTo - _radiusFrom);
-		Assert(!std::isnan(diff));
-		const auto mult = diff * shown;
-		Assert(!std::isnan(mult));
-		const auto interpolated = _radiusFrom + mult;
-		//anim::interpolateF(_radiusFrom, _radiusTo, shown);
-		Assert(!std::isnan(interpolated));
-		auto radius = int(base::SafeRound(interpolated));
-		//anim::interpolate(_radiusFrom, _radiusTo, _show.value(1.));
+	auto saved = p.opacity();
+	if (opacity != 1.) p.setOpacity(saved * opacity);
+	if (rectMask) {
+		// The mask is a plain rect, draw the ripple itself.
+		paintInRect(p, mask, colorOverride);
+		if (opacity != 1.) p.setOpacity(saved);
+		return;
+	}
+	if (!_cached || colorOverride != nullptr) {
+		const auto radius = currentRadius();
+		if (_frame.isNull()) {
+			_frame = TakeFrame(mask.size(), mask.devicePixelRatio());
+		}
 		_frame.fill(Qt::transparent);
 		{
 			QPainter p(&_frame);
@@ -136,17 +282,9 @@ void RippleAnimation::Ripple::paint(
 			p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
 			p.drawPixmap(0, 0, mask);
 		}
-		if (radius == _radiusTo && colorOverride == nullptr) {
-			_cache = PixmapFromImage(std::move(_frame));
-		}
-	}
-	auto saved = p.opacity();
-	if (opacity != 1.) p.setOpacity(saved * opacity);
-	if (_cache.isNull()) {
-		p.drawImage(0, 0, _frame);
-	} else {
-		p.drawPixmap(0, 0, _cache);
+		_cached = (radius == _radiusTo && colorOverride == nullptr);
 	}
+	p.drawImage(0, 0, _frame);
 	if (opacity != 1.) p.setOpacity(saved);
 }
 
@@ -173,7 +311,7 @@ void RippleAnimation::Ripple::finish() {
 }
 
 void RippleAnimation::Ripple::clearCache() {
-	_cache = QPixmap();
+	_cached = false;
 }
 
 RippleAnimation::RippleAnimation(
@@ -181,8 +319,16 @@ RippleAnimation::RippleAnimation(
 	QImage mask,
 	Fn<void()> callback)
 : _st(st)
-, _mask(PixmapFromImage(std::move(mask)))
 , _update(std::move(callback)) {
+	if (const auto cached = FindCachedMask(mask)) {
+		if (cached->pixmap.isNull()) {
+			cached->pixmap = PixmapFromImage(base::duplicate(mask));
+		}
+		_mask = cached->pixmap;
+		_rectMask = (cached->type == MaskType::Rect);
+	} else {
+		_mask = PixmapFromImage(std::move(mask));
+	}
 }
 
 
@@ -239,7 +385,7 @@ void RippleAnimation::paint(
 	}
 	p.translate(x, y);
 	for (const auto &ripple : _ripples) {
-		ripple->paint(p, _mask, colorOverride);
+		ripple->paint(p, _mask, colorOverride, _rectMask);
 	}
 	p.translate(-x, -y);
 	clearFinished();
@@ -266,12 +412,22 @@ QImage RippleAnimation::MaskByDrawer(
 }
 
 QImage RippleAnimation::RectMask(QSize size) {
-	return MaskByDrawer(size, true, nullptr);
+	return CachedMaskImage(MaskType::Rect, size, 0, [&] {
+		return MaskByDrawer(size, true, nullptr);
+	});
 }
 
 QImage RippleAnimation::RoundRectMask(QSize size, int radius) {
-	return MaskByDrawer(size, false, [&](QPainter &p) {
-		p.drawRoundedRect(0, 0, size.width(), size.height(), radius, radius);
+	return CachedMaskImage(MaskType::RoundRect, size, radius, [&] {
+		return MaskByDrawer(size, false, [&](QPainter &p) {
+			p.drawRoundedRect(
+				0,
+				0,
+				size.width(),
+				size.height(),
+				radius,
+				radius);
+		});
 	});
 }
 
@@ -304,8 +460,10 @@ QImage RippleAnimation::RoundRectMask(
 }
 
 QImage RippleAnimation::EllipseMask(QSize size) {
-	return MaskByDrawer(size, false, [&](QPainter &p) {
-		p.drawEllipse(0, 0, size.width(), size.height());
+	return CachedMaskImage(MaskType::Ellipse, size, 0, [&] {
+		return MaskByDrawer(size, false, [&](QPainter &p) {
+			p.drawEllipse(0, 0, size.width(), size.height());
+		});
 	});
 }
 
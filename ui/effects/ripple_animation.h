@@ -63,6 +63,7 @@ private:
 	const style::RippleAnimation &_st;
 	QPixmap _mask;
 	Fn<void()> _update;
+	bool _rectMask = false;
 
 	class Ripple;
 	std::deque<std::unique_ptr<Ripple>> _ripples;
@@ -16,6 +16,8 @@
 #include <QtCore/QBuffer>
 #include <QtCore/QFile>
 #include <QtCore/QDir>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
 
 #include <crl/crl_async.h>
 #include <xxhash.h>
@@ -32,6 +34,7 @@ constexpr auto kMaxCacheSize = 5 * 1024 * 1024;
 constexpr auto kDefaultFrameDuration = crl::time(33);
 constexpr auto kDefaultFramesCount = 60;
 constexpr auto kAutoPauseTimeout = crl::time(1000);
+constexpr auto kFrameBrushesCached = 4;
 
 [[nodiscard]] SpoilerMessDescriptor DefaultDescriptorText() {
 	const auto ratio = style::DevicePixelRatio();
@@ -193,6 +196,176 @@ struct Particle {
 	return result;
 }
 
+// Particles in structure-of-arrays form, so that computing the positions
+// and the opacities for a frame is a tight loop over plain arrays.
+struct Particles {
+	std::vector<crl::time> start;
+	std::vector<int> spriteIndex;
+	std::vector<int> x;
+	std::vector<int> y;
+	std::vector<float64> dx;
+	std::vector<float64> dy;
+};
+
+// Sprite copies visible in one frame, in the order they are blended.
+struct FrameInstances {
+	std::vector<int> x;
+	std::vector<int> y;
+	std::vector<int> alpha;
+	std::vector<int> spriteIndex;
+};
+
+struct GenerateContext {
+	SpoilerMessDescriptor descriptor;
+	Particles particles;
+	std::vector<QImage> sprites;
+	int spriteSize = 0;
+	int columns = 0;
+	crl::time singleDuration = 0;
+	crl::time fullDuration = 0;
+	uchar *bits = nullptr;
+	int bytesPerLine = 0;
+
+	std::atomic<int> next = 0;
+	std::mutex mutex;
+	std::condition_variable variable;
+	int finished = 0;
+};
+
+// Same as BYTE_MUL in Qt, the blending below must match the raster engine
+// drawing an image with opacity, so that the result stays the same as it
+// was when the frames were painted with QPainter.
+[[nodiscard]] inline uint32 ByteMultiply(uint32 x, uint32 a) {
+	auto t = (x & 0xFF00FFU) * a;
+	t = ((t + ((t >> 8) & 0xFF00FFU) + 0x800080U) >> 8) & 0xFF00FFU;
+	x = ((x >> 8) & 0xFF00FFU) * a;
+	x = (x + ((x >> 8) & 0xFF00FFU) + 0x800080U) & 0xFF00FF00U;
+	return x | t;
+}
+
+void BlendSpan(uint32 *to, const uint32 *from, int count, int alpha256) {
+	if (alpha256 == 256) {
+		for (auto i = 0; i != count; ++i) {
+			const auto s = from[i];
+			if (s >= 0xFF000000U) {
+				to[i] = s;
+			} else if (s) {
+				to[i] = s + ByteMultiply(to[i], (~s) >> 24);
+			}
+		}
+	} else if (alpha256) {
+		const auto alpha = uint32(alpha256 * 255) >> 8;
+		for (auto i = 0; i != count; ++i) {
+			if (const auto s = ByteMultiply(from[i], alpha)) {
+				to[i] = s + ByteMultiply(to[i], (~s) >> 24);
+			}
+		}
+	}
+}
+
+void CollectFrameInstances(
+		const GenerateContext &context,
+		crl::time time,
+		FrameInstances &instances) {
+	const auto &descriptor = context.descriptor;
+	const auto &particles = context.particles;
+	const auto size = descriptor.canvasSize;
+	const auto single = context.singleDuration;
+	const auto fadeIn = descriptor.particleFadeInDuration;
+	const auto fadeOut = descriptor.particleFadeOutDuration;
+	instances.x.clear();
+	instances.y.clear();
+	instances.alpha.clear();
+	instances.spriteIndex.clear();
+	const auto add = [&](int index, crl::time now) {
+		if (now <= 0 || now >= single) {
+			return;
+		}
+		const auto clamp = [&](int value) {
+			return ((value % size) + size) % size;
+		};
+		const auto opacity = (now < fadeIn)
+			? (now / float64(fadeIn))
+			: (now > single - fadeOut)
+			? ((single - now) / float64(fadeOut))
+			: 1.;
+		instances.x.push_back(clamp(particles.x[index]
+			+ int(base::SafeRound(now * particles.dx[index]))));
+		instances.y.push_back(clamp(particles.y[index]
+			+ int(base::SafeRound(now * particles.dy[index]))));
+		instances.alpha.push_back(qRound(opacity * 256));
+		instances.spriteIndex.push_back(particles.spriteIndex[index]);
+	};
+	for (auto i = 0, count = int(particles.start.size()); i != count; ++i) {
+		add(i, time - particles.start[i]);
+		add(i, time + context.fullDuration - particles.start[i]);
+	}
+}
+
+void RasterizeFrame(
+		const GenerateContext &context,
+		int frame,
+		FrameInstances &instances) {
+	const auto size = context.descriptor.canvasSize;
+	const auto spriteSize = context.spriteSize;
+	const auto intsPerLine = context.bytesPerLine / 4;
+	const auto row = frame / context.columns;
+	const auto column = frame % context.columns;
+	const auto cell = reinterpret_cast<uint32*>(context.bits
+		+ row * size * context.bytesPerLine
+		+ column * size * 4);
+
+	CollectFrameInstances(
+		context,
+		frame * context.descriptor.frameDuration,
+		instances);
+	for (auto i = 0, count = int(instances.x.size()); i != count; ++i) {
+		const auto &sprite = context.sprites[instances.spriteIndex[i]];
+		const auto spriteInts = reinterpret_cast<const uint32*>(
+			sprite.constBits());
+		const auto spriteIntsPerLine = sprite.bytesPerLine() / 4;
+		const auto x = instances.x[i];
+		const auto alpha = instances.alpha[i];
+		const auto first = std::min(spriteSize, size - x);
+		const auto second = spriteSize - first;
+
+		// Sprites leaving the canvas are wrapped to the opposite side.
+		auto y = instances.y[i];
+		for (auto line = 0; line != spriteSize; ++line) {
+			const auto to = cell + y * intsPerLine;
+			const auto from = spriteInts + line * spriteIntsPerLine;
+			BlendSpan(to + x, from, first, alpha);
+			if (second > 0) {
+				BlendSpan(to, from + first, second, alpha);
+			}
+			if (++y == size) {
+				y = 0;
+			}
+		}
+	}
+}
+
+void RasterizeFrames(GenerateContext &context) {
+	auto instances = FrameInstances();
+	const auto frames = context.descriptor.framesCount;
+	auto finished = 0;
+	while (true) {
+		const auto frame = context.next++;
+		if (frame >= frames) {
+			break;
+		}
+		RasterizeFrame(context, frame, instances);
+		++finished;
+	}
+	if (finished) {
+		auto lock = std::unique_lock(context.mutex);
+		context.finished += finished;
+		if (context.finished == frames) {
+			context.variable.notify_all();
+		}
+	}
+}
+
 [[nodiscard]] QString DefaultMaskCacheFolder() {
 	const auto base = Integration::Instance().emojiCacheFolder();
 	return base.isEmpty() ? QString() : (base + "/spoiler");
@@ -351,6 +524,36 @@ void PrepareTextSpoilerMask() {
 		[](std::unique_ptr<SpoilerMessCached> cached) { return cached; });
 }
 
+// Frames are tiled by a texture brush, a whole rect in a single fill.
+// Many spoilers show the same frame at once, so the last few frames
+// extracted from the atlases are kept here.
+[[nodiscard]] QBrush SpoilerFrameBrush(const SpoilerMessFrame &frame) {
+	struct Cached {
+		qint64 key = 0;
+		QPoint position;
+		QBrush brush;
+	};
+	static auto Cache = std::vector<Cached>();
+	static auto Mutex = QMutex();
+	auto lock = QMutexLocker(&Mutex);
+
+	const auto key = frame.image->cacheKey();
+	const auto position = frame.source.topLeft();
+	const auto i = ranges::find_if(Cache, [&](const Cached &cached) {
+		return (cached.key == key) && (cached.position == position);
+	});
+	if (i != end(Cache)) {
+		return i->brush;
+	}
+	auto texture = frame.image->copy(frame.source);
+	texture.setDevicePixelRatio(1.);
+	if (Cache.size() == kFrameBrushesCached) {
+		Cache.erase(begin(Cache));
+	}
+	Cache.push_back({ key, position, QBrush(std::move(texture)) });
+	return Cache.back().brush;
+}
+
 } // namespace
 
 SpoilerAnimationManager::SpoilerAnimationManager(
@@ -410,13 +613,25 @@ SpoilerMessCached GenerateSpoilerMess(
 		+ descriptor.particleFadeOutDuration;
 	const auto fullDuration = frames * descriptor.frameDuration;
 	Assert(fullDuration > singleDuration);
+	Assert(spriteSize <= size);
 
 	auto random = base::BufferedRandom<uint32>(count * 5);
 
-	auto particles = std::vector<Particle>();
-	particles.reserve(descriptor.particlesCount);
-	for (auto i = 0; i != descriptor.particlesCount; ++i) {
-		particles.push_back(GenerateParticle(descriptor, i, random));
+	auto particles = Particles();
+	particles.start.reserve(count);
+	particles.spriteIndex.reserve(count);
+	particles.x.reserve(count);
+	particles.y.reserve(count);
+	particles.dx.reserve(count);
+	particles.dy.reserve(count);
+	for (auto i = 0; i != count; ++i) {
+		const auto particle = GenerateParticle(descriptor, i, random);
+		particles.start.push_back(particle.start);
+		particles.spriteIndex.push_back(particle.spriteIndex);
+		particles.x.push_back(particle.x);
+		particles.y.push_back(particle.y);
+		particles.dx.push_back(particle.dx);
+		particles.dy.push_back(particle.dy);
 	}
 
 	auto sprites = std::vector<QImage>();
@@ -425,57 +640,34 @@ SpoilerMessCached GenerateSpoilerMess(
 		sprites.push_back(GenerateSprite(descriptor, i, spriteSize, random));
 	}
 
-	auto frame = 0;
 	auto image = QImage(width, height, QImage::Format_ARGB32_Premultiplied);
 	image.fill(Qt::transparent);
-	auto p = QPainter(&image);
-	const auto paintOneAt = [&](const Particle &particle, crl::time now) {
-		if (now <= 0 || now >= singleDuration) {
-			return;
-		}
-		const auto clamp = [&](int value) {
-			return ((value % size) + size) % size;
-		};
-		const auto x = clamp(
-			particle.x + int(base::SafeRound(now * particle.dx)));
-		const auto y = clamp(
-			particle.y + int(base::SafeRound(now * particle.dy)));
-		const auto opacity = (now < descriptor.particleFadeInDuration)
-			? (now / float64(descriptor.particleFadeInDuration))
-			: (now > singleDuration - descriptor.particleFadeOutDuration)
-			? ((singleDuration - now)
-				/ float64(descriptor.particleFadeOutDuration))
-			: 1.;
-		p.setOpacity(opacity);
-		const auto &sprite = sprites[particle.spriteIndex];
-		p.drawImage(x, y, sprite);
-		if (x + spriteSize > size) {
-			p.drawImage(x - size, y, sprite);
-			if (y + spriteSize > size) {
-				p.drawImage(x, y - size, sprite);
-				p.drawImage(x - size, y - size, sprite);
-			}
-		} else if (y + spriteSize > size) {
-			p.drawImage(x, y - size, sprite);
-		}
-	};
-	const auto paintOne = [&](const Particle &particle, crl::time now) {
-		paintOneAt(particle, now - particle.start);
-		paintOneAt(particle, now + fullDuration - particle.start);
-	};
-	for (auto y = 0; y != rows; ++y) {
-		for (auto x = 0; x != columns; ++x) {
-			const auto rect = QRect(x * size, y * size, size, size);
-			p.setClipRect(rect);
-			p.translate(rect.topLeft());
-			const auto time = frame * descriptor.frameDuration;
-			for (auto index = 0; index != count; ++index) {
-				paintOne(particles[index], time);
-			}
-			p.translate(-rect.topLeft());
-			if (++frame >= frames) {
-				break;
-			}
+
+	// Frames don't depend on each other, so they are rasterized in
+	// parallel. This thread takes frames as well, so it never waits for
+	// a helper that didn't start yet, and late helpers find no work left.
+	const auto context = std::make_shared<GenerateContext>();
+	context->descriptor = descriptor;
+	context->particles = std::move(particles);
+	context->sprites = std::move(sprites);
+	context->spriteSize = spriteSize;
+	context->columns = columns;
+	context->singleDuration = singleDuration;
+	context->fullDuration = fullDuration;
+	context->bits = image.bits();
+	context->bytesPerLine = image.bytesPerLine();
+	const auto helpers = std::clamp(
+		QThread::idealThreadCount() - 1,
+		0,
+		frames - 1);
+	for (auto i = 0; i != helpers; ++i) {
+		crl::async([=] { RasterizeFrames(*context); });
+	}
+	RasterizeFrames(*context);
+	{
+		auto lock = std::unique_lock(context->mutex);
+		while (context->finished < frames) {
+			context->variable.wait(lock);
 		}
 	}
 	return SpoilerMessCached(
@@ -493,75 +685,13 @@ void FillSpoilerRect(
 	if (rect.isEmpty()) {
 		return;
 	}
-	const auto &image = *frame.image;
-	const auto source = frame.source;
 	const auto ratio = style::DevicePixelRatio();
-	const auto origin = rect.topLeft() + originShift;
-	const auto size = source.width() / ratio;
-	const auto xSkipFrames = (origin.x() <= rect.x())
-		? ((rect.x() - origin.x()) / size)
-		: -((origin.x() - rect.x() + size - 1) / size);
-	const auto ySkipFrames = (origin.y() <= rect.y())
-		? ((rect.y() - origin.y()) / size)
-		: -((origin.y() - rect.y() + size - 1) / size);
-	const auto xFrom = origin.x() + size * xSkipFrames;
-	const auto yFrom = origin.y() + size * ySkipFrames;
-	Assert((xFrom <= rect.x())
-		&& (yFrom <= rect.y())
-		&& (xFrom + size > rect.x())
-		&& (yFrom + size > rect.y()));
-	const auto xTill = rect.x() + rect.width();
-	const auto yTill = rect.y() + rect.height();
-	const auto xCount = (xTill - xFrom + size - 1) / size;
-	const auto yCount = (yTill - yFrom + size - 1) / size;
-	Assert(xCount > 0 && yCount > 0);
-	const auto xFullFrom = (xFrom < rect.x()) ? 1 : 0;
-	const auto yFullFrom = (yFrom < rect.y()) ? 1 : 0;
-	const auto xFullTill = xCount - (xFrom + xCount * size > xTill ? 1 : 0);
-	const auto yFullTill = yCount - (yFrom + yCount * size > yTill ? 1 : 0);
-	const auto targetRect = [&](int x, int y) {
-		return QRect(xFrom + x * size, yFrom + y * size, size, size);
-	};
-	const auto drawFull = [&](int x, int y) {
-		p.drawImage(targetRect(x, y), image, source);
-	};
-	const auto drawPart = [&](int x, int y) {
-		const auto target = targetRect(x, y);
-		const auto fill = target.intersected(rect);
-		Assert(!fill.isEmpty());
-		p.drawImage(fill, image, QRect(
-			source.topLeft() + ((fill.topLeft() - target.topLeft()) * ratio),
-			fill.size() * ratio));
-	};
-	if (yFullFrom) {
-		for (auto x = 0; x != xCount; ++x) {
-			drawPart(x, 0);
-		}
-	}
-	if (yFullFrom < yFullTill) {
-		if (xFullFrom) {
-			for (auto y = yFullFrom; y != yFullTill; ++y) {
-				drawPart(0, y);
-			}
-		}
-		if (xFullFrom < xFullTill) {
-			for (auto y = yFullFrom; y != yFullTill; ++y) {
-				for (auto x = xFullFrom; x != xFullTill; ++x) {
-					drawFull(x, y);
-				}
-			}
-		}
-		if (xFullFrom <= xFullTill && xFullTill < xCount) {
-			for (auto y = yFullFrom; y != yFullTill; ++y) {
-				drawPart(xFullTill, y);
-			}
-		}
-	}
-	if (yFullFrom <= yFullTill && yFullTill < yCount) {
-		for (auto x = 0; x != xCount; ++x) {
-			drawPart(x, yFullTill);
-		}
-	}
+	const auto origin = rect.topLeft() + originShift - p.brushOrigin();
+	auto brush = SpoilerFrameBrush(frame);
+	brush.setTransform(QTransform::fromTranslate(
+		origin.x(),
+		origin.y()).scale(1. / ratio, 1. / ratio));
+	p.fillRect(rect, brush);
 }
 
 void FillSpoilerRect(
@@ -16,10 +16,12 @@
 #include "styles/palette.h"
 #include "styles/style_basic.h"
 
+#include <crl/crl_async.h>
 #include <zlib.h>
 #include <QtCore/QFile>
 #include <QtCore/QBuffer>
 #include <QtCore/QMutex>
+#include <QtCore/QThread>
 #include <QtGui/QImageReader>
 #include <QtSvg/QSvgRenderer>
 
@@ -45,6 +47,9 @@ namespace {
 
 // They should be smaller.
 constexpr auto kMaxGzipFileSize = 5 * 1024 * 1024;
+constexpr auto kMaxJpegWorkers = 4;
+constexpr auto kLinearGradientSide = 512;
+constexpr auto kLinearGradientMaxScale = 4;
 
 TG_FORCE_INLINE uint64 BlurGetColors(const uchar *p) {
 	return (uint64)p[0]
@@ -53,6 +58,87 @@ TG_FORCE_INLINE uint64 BlurGetColors(const uchar *p) {
 		+ ((uint64)p[3] << 48);
 }
 
+[[nodiscard]] TG_FORCE_INLINE uint64 BoxSpread(uint32 pixel) {
+	return uint64(pixel & 0xFFU)
+		| (uint64((pixel >> 8) & 0xFFU) << 16)
+		| (uint64((pixel >> 16) & 0xFFU) << 32)
+		| (uint64(pixel >> 24) << 48);
+}
+
+[[nodiscard]] TG_FORCE_INLINE uint32 BoxAverage(uint64 sum, uint32 multiplier) {
+	const auto lane = [&](int shift) {
+		const auto value = uint32((sum >> shift) & 0xFFFFU);
+		return ((value * multiplier + 0x8000U) >> 16);
+	};
+	return lane(0)
+		| (lane(16) << 8)
+		| (lane(32) << 16)
+		| (lane(48) << 24);
+}
+
+// Sums of up to 255 pixels fit in the 16 bit lanes of BoxSpread,
+// BoxAverage keeps 0xFF lanes exact for up to 129 pixels.
+void BoxBlurHorizontal(QImage &image, int half, std::vector<uint64> &row) {
+	const auto width = image.width();
+	const auto height = image.height();
+	const auto last = width - 1;
+	const auto multiplier = uint32(65536 / (2 * half + 1));
+	row.resize(width);
+	for (auto y = 0; y != height; ++y) {
+		const auto line = reinterpret_cast<uint32*>(image.scanLine(y));
+		for (auto x = 0; x != width; ++x) {
+			row[x] = BoxSpread(line[x]);
+		}
+		auto sum = uint64();
+		for (auto i = -half; i <= half; ++i) {
+			sum += row[std::clamp(i, 0, last)];
+		}
+		for (auto x = 0; x != width; ++x) {
+			line[x] = BoxAverage(sum, multiplier);
+			sum += row[std::min(x + half + 1, last)];
+			sum -= row[std::max(x - half, 0)];
+		}
+	}
+}
+
+// Keeps the last (2 * half + 1) source rows, so the scratch is O(width).
+void BoxBlurVertical(
+		QImage &image,
+		int half,
+		std::vector<uint64> &sums,
+		std::vector<uint64> &ring) {
+	const auto width = image.width();
+	const auto height = image.height();
+	const auto last = height - 1;
+	const auto lines = 2 * half + 1;
+	const auto multiplier = uint32(65536 / lines);
+	sums.assign(width, 0);
+	ring.resize(lines * width);
+	const auto load = [&](uint64 *slot, int y) {
+		const auto line = reinterpret_cast<const uint32*>(
+			image.constScanLine(std::clamp(y, 0, last)));
+		for (auto x = 0; x != width; ++x) {
+			sums[x] += (slot[x] = BoxSpread(line[x]));
+		}
+	};
+	for (auto i = -half; i <= half; ++i) {
+		load(ring.data() + (i + half) * width, i);
+	}
+	for (auto y = 0; y != height; ++y) {
+		const auto line = reinterpret_cast<uint32*>(image.scanLine(y));
+		for (auto x = 0; x != width; ++x) {
+			line[x] = BoxAverage(sums[x], multiplier);
+		}
+
+		// Row (y - half) leaves the window, row (y + half + 1) enters it.
+		const auto slot = ring.data() + (y % lines) * width;
+		for (auto x = 0; x != width; ++x) {
+			sums[x] -= slot[x];
+		}
+		load(slot, y + half + 1);
+	}
+}
+
 const QImage &EllipseMaskCached(QSize size) {
 	const auto key = (uint64(uint32(size.width())) << 32)
 		| uint64(uint32(size.height()));
@@ -195,6 +281,15 @@ template <int kBits> // 4 means 16x16, 3 means 8x8
 	const auto previousPhase = (phase + 1) % 8;
 	const auto previous = positionsForPhase(previousPhase);
 	const auto current = positionsForPhase(phase);
+	auto points = std::array<std::pair<float, float>, 4>();
+	for (auto i = 0; i != 4; ++i) {
+		points[i] = {
+			previous[i].first
+				+ (current[i].first - previous[i].first) * progress,
+			previous[i].second
+				+ (current[i].second - previous[i].second) * progress,
+		};
+	}
 
 	constexpr auto kWidth = 64;
 	constexpr auto kHeight = 64;
@@ -262,13 +357,8 @@ template <int kBits> // 4 means 16x16, 3 means 8x8
 			auto g = 0.f;
 			auto b = 0.f;
 			for (auto i = 0; i != colorsCount; ++i) {
-				const auto colorX = previous[i].first
-					+ (current[i].first - previous[i].first) * progress;
-				const auto colorY = previous[i].second
-					+ (current[i].second - previous[i].second) * progress;
-
-				const auto dx = pixelX - colorX;
-				const auto dy = pixelY - colorY;
+				const auto dx = pixelX - points[i].first;
+				const auto dy = pixelY - points[i].second;
 				const auto distance = std::max(
 					0.0f,
 					0.9f - sqrtf(dx * dx + dy * dy));
@@ -304,6 +394,136 @@ template <int kBits> // 4 means 16x16, 3 means 8x8
 			Qt::SmoothTransformation);
 }
 
+// Keeps libjpeg objects alive between images, resetting them with abort.
+class JpegTranscoder final {
+public:
+	JpegTranscoder();
+	~JpegTranscoder();
+
+	[[nodiscard]] QByteArray makeProgressive(const QByteArray &bytes);
+
+private:
+	jpeg_decompress_struct _source;
+	jpeg_compress_struct _destination;
+	my_error_mgr _error;
+	unsigned char *_buffer = nullptr;
+	unsigned long _size = 0;
+
+};
+
+JpegTranscoder::JpegTranscoder() {
+	_source.err = jpeg_std_error(&_error);
+	_destination.err = jpeg_std_error(&_error);
+	_error.error_exit = my_error_exit;
+	jpeg_create_decompress(&_source);
+	jpeg_create_compress(&_destination);
+}
+
+JpegTranscoder::~JpegTranscoder() {
+	jpeg_destroy_compress(&_destination);
+	jpeg_destroy_decompress(&_source);
+}
+
+QByteArray JpegTranscoder::makeProgressive(const QByteArray &bytes) {
+	_buffer = nullptr;
+	_size = 0;
+	if (setjmp(_error.setjmp_buffer)) {
+		free(base::take(_buffer));
+		jpeg_abort_compress(&_destination);
+		jpeg_abort_decompress(&_source);
+		return {};
+	}
+
+	jpeg_mem_src(
+		&_source,
+		reinterpret_cast<const unsigned char*>(bytes.data()),
+		bytes.size());
+
+	jpeg_save_markers(&_source, JPEG_COM, 0xFFFF);
+	for (int m = 0; m < 16; m++) {
+		jpeg_save_markers(&_source, JPEG_APP0 + m, 0xFFFF);
+	}
+
+	jpeg_read_header(&_source, true);
+	const auto coefArrays = jpeg_read_coefficients(&_source);
+	jpeg_copy_critical_parameters(&_source, &_destination);
+	jpeg_simple_progression(&_destination);
+	jpeg_mem_dest(&_destination, &_buffer, &_size);
+	jpeg_write_coefficients(&_destination, coefArrays);
+
+	for (jpeg_saved_marker_ptr marker = _source.marker_list
+		; marker != nullptr
+		; marker = marker->next) {
+		if (_destination.write_JFIF_header
+			&& marker->marker == JPEG_APP0
+			&& marker->data_length >= 5
+			&& marker->data[0] == 0x4A
+			&& marker->data[1] == 0x46
+			&& marker->data[2] == 0x49
+			&& marker->data[3] == 0x46
+			&& marker->data[4] == 0)
+			continue; // reject duplicate JFIF
+		if (_destination.write_Adobe_marker
+			&& marker->marker == JPEG_APP0 + 14
+			&& marker->data_length >= 5
+			&& marker->data[0] == 0x41
+			&& marker->data[1] == 0x64
+			&& marker->data[2] == 0x6F
+			&& marker->data[3] == 0x62
+			&& marker->data[4] == 0x65)
+			continue; // reject duplicate Adobe
+		jpeg_write_marker(
+			&_destination,
+			marker->marker,
+			marker->data,
+			marker->data_length);
+	}
+
+	jpeg_finish_compress(&_destination);
+	jpeg_finish_decompress(&_source);
+
+	const auto bufferGuard = gsl::finally([&] {
+		free(base::take(_buffer));
+	});
+
+	return QByteArray(reinterpret_cast<char*>(_buffer), _size);
+}
+
+struct JpegTranscoders {
+	QMutex mutex;
+	std::vector<std::unique_ptr<JpegTranscoder>> list;
+};
+
+[[nodiscard]] JpegTranscoders &Transcoders() {
+	static const auto result = new JpegTranscoders();
+	return *result;
+}
+
+[[nodiscard]] std::unique_ptr<JpegTranscoder> TakeJpegTranscoder() {
+	auto &transcoders = Transcoders();
+	QMutexLocker lock(&transcoders.mutex);
+	if (transcoders.list.empty()) {
+		return std::make_unique<JpegTranscoder>();
+	}
+	auto result = std::move(transcoders.list.back());
+	transcoders.list.pop_back();
+	return result;
+}
+
+void ReturnJpegTranscoder(std::unique_ptr<JpegTranscoder> transcoder) {
+	auto &transcoders = Transcoders();
+	QMutexLocker lock(&transcoders.mutex);
+	if (int(transcoders.list.size()) < kMaxJpegWorkers) {
+		transcoders.list.push_back(std::move(transcoder));
+	}
+}
+
+struct ProgressiveJpegsBatch {
+	std::vector<QByteArray> list;
+	Fn<void(int, QByteArray)> done;
+	std::atomic<int> next = 0;
+};
+
 } // namespace
 
 QPixmap PixmapFast(QImage &&image) {
@@ -449,13 +669,10 @@ std::array<QImage, 4> PrepareCorners(
 	return result;
 }
 
-[[nodiscard]] ReadResult ReadOther(const ReadArgs &args) {
-	auto bytes = args.content;
-	if (bytes.isEmpty()) {
-		return {};
-	}
-	auto buffer = QBuffer(&bytes);
-	auto reader = QImageReader(&buffer);
+[[nodiscard]] ReadResult ReadOther(
+		not_null<QIODevice*> device,
+		const ReadArgs &args) {
+	auto reader = QImageReader(device);
 	reader.setAutoTransform(true);
 	if (!reader.canRead()) {
 		return {};
@@ -470,6 +687,26 @@ std::array<QImage, 4> PrepareCorners(
 	result.format = reader.format().toLower();
 	result.animated = reader.supportsAnimation()
 		&& (reader.imageCount() > 1);
+	if (!result.animated
+		&& !args.maxSize.isEmpty()
+		&& reader.supportsOption(QImageIOHandler::ScaledSize)) {
+		// Scaled size is applied before the EXIF transformation.
+		const auto rotated = reader.transformation().testFlag(
+			QImageIOHandler::TransformationRotate90);
+		const auto limit = rotated
+			? args.maxSize.transposed()
+			: args.maxSize;
+		if (size.width() > limit.width() || size.height() > limit.height()) {
+			// JPEG and WebP handlers decode straight to the scaled size.
+			const auto scaled = size.scaled(limit, Qt::KeepAspectRatio);
+			if (!scaled.isEmpty()) {
+				reader.setScaledSize(scaled);
+				result.scale = (size.width() > size.height())
+					? float64(scaled.width()) / size.width()
+					: float64(scaled.height()) / size.height();
+			}
+		}
+	}
 	if (!reader.read(&result.image) || result.image.isNull()) {
 		return {};
 	}
@@ -477,18 +714,33 @@ std::array<QImage, 4> PrepareCorners(
 }
 
 ReadResult Read(ReadArgs &&args) {
+	auto file = QFile();
+	auto buffer = QBuffer();
+	QIODevice *device = nullptr;
 	if (args.content.isEmpty()) {
 		if (args.path.isEmpty()) {
 			return {};
 		}
-		auto file = QFile(args.path);
+		file.setFileName(args.path);
 		if (file.size() > kReadBytesLimit
 			|| !file.open(QIODevice::ReadOnly)) {
 			return {};
+		} else if (args.gzipSvg || args.returnContent) {
+			args.content = file.readAll();
+		} else {
+			device = &file;
+		}
+	}
+	if (!device) {
+		buffer.setBuffer(&args.content);
+		if (!buffer.open(QIODevice::ReadOnly)) {
+			return {};
 		}
-		args.content = file.readAll();
+		device = &buffer;
 	}
-	auto result = args.gzipSvg ? ReadGzipSvg(args) : ReadOther(args);
+	auto result = args.gzipSvg
+		? ReadGzipSvg(args)
+		: ReadOther(device, args);
 	if (result.image.isNull()) {
 		args = ReadArgs();
 		return {};
@@ -883,6 +1135,58 @@ yi += stride;
 	return std::move(image);
 }
 
+[[nodiscard]] QImage BlurLargeImageFast(QImage &&image, int radius) {
+	constexpr auto kMaxScale = 8;
+	constexpr auto kScaledRadius = 4;
+	constexpr auto kMaxHalf = 63;
+
+	const auto width = image.width();
+	const auto height = image.height();
+	if (width <= radius || height <= radius || radius < 1) {
+		return std::move(image);
+	}
+	const auto ratio = image.devicePixelRatio();
+	const auto scale = std::clamp(radius / kScaledRadius, 1, kMaxScale);
+	if (scale > 1) {
+		image = image.scaled(
+			(width + scale - 1) / scale,
+			(height + scale - 1) / scale,
+			Qt::IgnoreAspectRatio,
+			Qt::SmoothTransformation);
+	}
+	if (image.format() != QImage::Format_RGB32
+		&& image.format() != QImage::Format_ARGB32_Premultiplied) {
+		image = std::move(image).convertToFormat(
+			QImage::Format_ARGB32_Premultiplied);
+	}
+
+	// BlurLargeImage weights are triangular, variance is r * (r + 2) / 6.
+	// Three box passes of (2 * half + 1) give 3 * ((2 * half + 1)^2 - 1) / 12.
+	const auto scaled = radius / float64(scale);
+	const auto variance = scaled * (scaled + 2.) / 6.;
+	const auto size = std::sqrt(4. * variance + 1.);
+	const auto half = std::clamp(
+		int(base::SafeRound((size - 1.) / 2.)),
+		1,
+		std::min({ kMaxHalf, image.width() - 1, image.height() - 1 }));
+
+	auto row = std::vector<uint64>();
+	auto ring = std::vector<uint64>();
+	for (auto i = 0; i != 3; ++i) {
+		BoxBlurHorizontal(image, half, row);
+		BoxBlurVertical(image, half, row, ring);
+	}
+	if (scale > 1) {
+		image = image.scaled(
+			width,
+			height,
+			Qt::IgnoreAspectRatio,
+			Qt::SmoothTransformation);
+	}
+	image.setDevicePixelRatio(ratio);
+	return std::move(image);
+}
+
 [[nodiscard]] QImage DitherImage(const QImage &image) {
 	Expects(image.bytesPerLine() == image.width() * 4);
 
@@ -925,17 +1229,37 @@ QImage GenerateLinearGradient(
 		int rotation) {
 	Expects(!colors.empty());
 
-	auto result = QImage(size, QImage::Format_RGB32);
 	if (colors.size() == 1) {
+		auto result = QImage(size, QImage::Format_RGB32);
 		result.fill(colors.front());
 		return result;
 	}
 
-	auto p = QPainter(&result);
-	const auto width = size.width();
-	const auto height = size.height();
+	const auto type = std::clamp(rotation, 0, 315) / 45;
+	const auto vertical = (type == 0 || type == 4);
+	const auto horizontal = (type == 2 || type == 6);
+
+	// Axis-aligned gradients are painted as one column or row and copied.
+	// Large diagonal ones are painted smaller and upscaled, a bilinear
+	// interpolation of a linear gradient is the same linear gradient.
+	const auto scale = (vertical || horizontal)
+		? 1
+		: std::clamp(
+			std::max(size.width(), size.height()) / kLinearGradientSide,
+			1,
+			kLinearGradientMaxScale);
+	const auto width = vertical ? 1 : ((size.width() + scale - 1) / scale);
+	const auto height = horizontal
+		? 1
+		: ((size.height() + scale - 1) / scale);
+	auto small = (width == size.width() && height == size.height())
+		? QImage()
+		: QImage(width, height, QImage::Format_RGB32);
+	auto result = (small.isNull() || vertical || horizontal)
+		? QImage(size, QImage::Format_RGB32)
+		: QImage();
+	auto p = QPainter(small.isNull() ? &result : &small);
 	const auto [start, finalStop] = [&]() -> std::pair<QPoint, QPoint> {
-		const auto type = std::clamp(rotation, 0, 315) / 45;
 		switch (type) {
 		case 0: return { { 0, 0 }, { 0, height } };
 		case 1: return { { width, 0 }, { 0, height } };
@@ -965,10 +1289,31 @@ QImage GenerateLinearGradient(
 		}
 		gradient.setStops(std::move(stops));
 	}
-	p.fillRect(QRect(QPoint(), size), QBrush(std::move(gradient)));
+	p.fillRect(QRect(0, 0, width, height), QBrush(std::move(gradient)));
 	p.end();
 
-	return result;
+	if (small.isNull()) {
+		return result;
+	} else if (vertical) {
+		const auto column = reinterpret_cast<const uint32*>(
+			small.constBits());
+		const auto perLine = small.bytesPerLine() / 4;
+		for (auto y = 0; y != size.height(); ++y) {
+			const auto line = reinterpret_cast<uint32*>(result.scanLine(y));
+			std::fill_n(line, size.width(), column[y * perLine]);
+		}
+		return result;
+	} else if (horizontal) {
+		const auto row = small.constBits();
+		for (auto y = 0; y != size.height(); ++y) {
+			memcpy(result.scanLine(y), row, size.width() * 4);
+		}
+		return result;
+	}
+	return small.scaled(
+		size,
+		Qt::IgnoreAspectRatio,
+		Qt::SmoothTransformation);
 }
 
 QImage GenerateShadow(
@@ -1320,82 +1665,41 @@ bool IsProgressiveJpeg(const QByteArray &bytes) {
 }
 
 QByteArray MakeProgressiveJpeg(const QByteArray &bytes) {
-	struct jpeg_decompress_struct srcinfo;
-	struct jpeg_compress_struct dstinfo;
-	struct my_error_mgr jerr;
-	unsigned char* outbuffer = nullptr;
-	long unsigned int outsize = 0;
-
-	srcinfo.err = jpeg_std_error(&jerr);
-	dstinfo.err = jpeg_std_error(&jerr);
-	jerr.error_exit = my_error_exit;
-	if (setjmp(jerr.setjmp_buffer)) {
-		free(outbuffer);
-		jpeg_abort_compress(&dstinfo);
-		jpeg_abort_decompress(&srcinfo);
-		jpeg_destroy_compress(&dstinfo);
-		jpeg_destroy_decompress(&srcinfo);
-		return {};
-	}
-
-	jpeg_create_decompress(&srcinfo);
-	jpeg_create_compress(&dstinfo);
-
-	jpeg_mem_src(
-		&srcinfo,
-		reinterpret_cast<const unsigned char*>(bytes.data()),
-		bytes.size());
-
-	jpeg_save_markers(&srcinfo, JPEG_COM, 0xFFFF);
-	for (int m = 0; m < 16; m++) {
-		jpeg_save_markers(&srcinfo, JPEG_APP0 + m, 0xFFFF);
-	}
-
-	jpeg_read_header(&srcinfo, true);
-	const auto coefArrays = jpeg_read_coefficients(&srcinfo);
-	jpeg_copy_critical_parameters(&srcinfo, &dstinfo);
-	jpeg_simple_progression(&dstinfo);
-	jpeg_mem_dest(&dstinfo, &outbuffer, &outsize);
-	jpeg_write_coefficients(&dstinfo, coefArrays);
+	auto transcoder = TakeJpegTranscoder();
+	auto result = transcoder->makeProgressive(bytes);
+	ReturnJpegTranscoder(std::move(transcoder));
+	return result;
+}
 
-	for (jpeg_saved_marker_ptr marker = srcinfo.marker_list
-		; marker != nullptr
-		; marker = marker->next) {
-		if (dstinfo.write_JFIF_header
-			&& marker->marker == JPEG_APP0
-			&& marker->data_length >= 5
-			&& marker->data[0] == 0x4A
-			&& marker->data[1] == 0x46
-			&& marker->data[2] == 0x49
-			&& marker->data[3] == 0x46
-			&& marker->data[4] == 0)
-			continue; // reject duplicate JFIF
-		if (dstinfo.write_Adobe_marker
-			&& marker->marker == JPEG_APP0 + 14
-			&& marker->data_length >= 5
-			&& marker->data[0] == 0x41
-			&& marker->data[1] == 0x64
-			&& marker->data[2] == 0x6F
-			&& marker->data[3] == 0x62
-			&& marker->data[4] == 0x65)
-			continue; // reject duplicate Adobe
-		jpeg_write_marker(
-			&dstinfo,
-			marker->marker,
-			marker->data,
-			marker->data_length);
+void MakeProgressiveJpegs(
+		std::vector<QByteArray> list,
+		Fn<void(int index, QByteArray result)> done) {
+	Expects(done != nullptr);
+
+	const auto count = int(list.size());
+	const auto workers = std::min(
+		count,
+		std::clamp(QThread::idealThreadCount(), 1, kMaxJpegWorkers));
+	if (!workers) {
+		return;
+	}
+	const auto batch = std::make_shared<ProgressiveJpegsBatch>();
+	batch->list = std::move(list);
+	batch->done = std::move(done);
+	for (auto i = 0; i != workers; ++i) {
+		crl::async([=] {
+			auto transcoder = TakeJpegTranscoder();
+			while (true) {
+				const auto index = batch->next++;
+				if (index >= count) {
+					break;
+				}
+				auto bytes = base::take(batch->list[index]);
+				batch->done(index, transcoder->makeProgressive(bytes));
+			}
+			ReturnJpegTranscoder(std::move(transcoder));
+		});
 	}
-
-	jpeg_finish_compress(&dstinfo);
-	jpeg_finish_decompress(&srcinfo);
-	jpeg_destroy_compress(&dstinfo);
-	jpeg_destroy_decompress(&srcinfo);
-
-	const auto outbufferGuard = gsl::finally([&] {
-		free(outbuffer);
-	});
-
-	return QByteArray(reinterpret_cast<char*>(outbuffer), outsize);
 }
 
 QByteArray ExpandInlineBytes(const QByteArray &bytes) {
@@ -27,6 +27,10 @@ namespace Images {
 
 [[nodiscard]] QPixmap PixmapFast(QImage &&image);
 [[nodiscard]] QImage BlurLargeImage(QImage &&image, int radius);
+
+// Approximates BlurLargeImage on a downscaled copy, for large radii.
+[[nodiscard]] QImage BlurLargeImageFast(QImage &&image, int radius);
+
 [[nodiscard]] QImage DitherImage(const QImage &image);
 
 [[nodiscard]] QImage GenerateGradient(
@@ -209,6 +213,12 @@ struct PrepareArgs {
 [[nodiscard]] bool IsProgressiveJpeg(const QByteArray &bytes);
 [[nodiscard]] QByteArray MakeProgressiveJpeg(const QByteArray &bytes);
 
+// Transcodes on up to four worker threads, calls done on them as soon as
+// each result is ready, with an empty QByteArray for a failed one.
+void MakeProgressiveJpegs(
+	std::vector<QByteArray> list,
+	Fn<void(int index, QByteArray result)> done);
+
 [[nodiscard]] QByteArray ExpandInlineBytes(const QByteArray &bytes);
 [[nodiscard]] QImage FromInlineBytes(const QByteArray &bytes);
 [[nodiscard]] QPainterPath PathFromInlineBytes(const QByteArray &bytes);
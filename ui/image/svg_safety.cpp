@@ -6,15 +6,24 @@
 //
 #include "ui/image/svg_safety.h"
 
+#include "base/algorithm.h"
 #include "base/debug_log.h"
 
+#include <crl/crl_async.h>
+#include <xxhash.h>
+
 #include <QtCore/QHash>
 #include <QtCore/QList>
+#include <QtCore/QMutex>
 #include <QtCore/QPair>
 #include <QtCore/QSet>
 #include <QtCore/QStringList>
+#include <QtCore/QThread>
 #include <QtCore/QXmlStreamReader>
 
+#include <atomic>
+#include <optional>
+
 namespace Images {
 namespace {
 
@@ -22,6 +31,9 @@ constexpr auto kMaxSvgElements = 100 * 1000;
 constexpr auto kMaxSvgNesting = 100;
 constexpr auto kMaxRenderDepth = 256;
 constexpr auto kMaxReferenceExpansion = 500 * 1000;
+constexpr auto kCachedVerdicts = 64;
+constexpr auto kMaxCachedSvgSize = 256 * 1024;
+constexpr auto kMaxSanitizeWorkers = 4;
 
 [[nodiscard]] bool IsName(const QString &value, const char *name) {
 	return (value.compare(QLatin1String(name), Qt::CaseInsensitive) == 0);
@@ -162,11 +174,41 @@ struct SubtreeInfo {
 	QList<QPair<QString, int>> children;
 };
 
+// An id'd element (or the root) that is still open. Its subtree size
+// and height are known when it is closed, so each element only touches
+// the innermost context, the maximum depth is passed up on close.
 struct ParseContext {
 	QString key;
 	int entryDepth = 0;
+	int entryCount = 0;
+	int maxDepth = 0;
 };
 
+void CloseContext(
+		QList<ParseContext> &contexts,
+		QHash<QString, SubtreeInfo> &infos,
+		int elements) {
+	const auto closed = contexts.takeLast();
+	auto &info = infos[closed.key];
+	info.subtreeCount += elements - closed.entryCount;
+	info.maxRelDepth = std::max(
+		info.maxRelDepth,
+		closed.maxDepth - closed.entryDepth + 1);
+	if (!contexts.isEmpty()) {
+		auto &parent = contexts.back();
+		parent.maxDepth = std::max(parent.maxDepth, closed.maxDepth);
+	}
+}
+
+struct CachedVerdict {
+	QByteArray bytes;
+	uint64 hash = 0;
+	bool safe = false;
+};
+
+std::vector<CachedVerdict> CachedVerdicts;
+QMutex CachedVerdictsMutex;
+
 class GraphEvaluator {
 public:
 	explicit GraphEvaluator(const QHash<QString, SubtreeInfo> &infos)
@@ -264,9 +306,7 @@ private:
 
 };
 
-} // namespace
-
-QByteArray SanitizeSvg(const QByteArray &bytes) {
+[[nodiscard]] bool CheckSvg(const QByteArray &bytes) {
 	auto reader = QXmlStreamReader(bytes);
 	auto hasRoot = false;
 	auto inStyle = 0;
@@ -291,19 +331,23 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 				hasRoot = true;
 				if (!IsName(name, "svg")) {
 					LOG(("Svg Sanitize: Invalid root element."));
-					return {};
+					return false;
 				}
-				contexts.push_back({ QString(), 1 });
+				contexts.push_back({
+					.key = QString(),
+					.entryDepth = 1,
+					.entryCount = elements,
+				});
 			}
 			if (IsDisallowedElement(name)
 				|| !AttributesAreSafe(attributes)) {
 				LOG(("Svg Sanitize: Disallowed element or attribute."));
-				return {};
+				return false;
 			}
 			if ((++elements > kMaxSvgElements)
 				|| (elementIds.size() >= kMaxSvgNesting)) {
 				LOG(("Svg Sanitize: Too many or too deeply nested elements."));
-				return {};
+				return false;
 			}
 			const auto id = attributes.value(QLatin1String("id")).toString();
 			const auto depth = int(elementIds.size() + 1);
@@ -313,15 +357,14 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 				const auto &parent = contexts.back();
 				current.children.push_back(
 					{ id, int(depth - parent.entryDepth + 1) });
-				contexts.push_back({ id, int(depth) });
-			}
-			for (auto &context : contexts) {
-				auto &info = infos[context.key];
-				info.subtreeCount++;
-				info.maxRelDepth = std::max(
-					info.maxRelDepth,
-					int(depth - context.entryDepth + 1));
+				contexts.push_back({
+					.key = id,
+					.entryDepth = depth,
+					.entryCount = elements - 1,
+				});
 			}
+			auto &context = contexts.back();
+			context.maxDepth = std::max(context.maxDepth, depth);
 			for (const auto &attribute : attributes) {
 				const auto attributeName = attribute.name().toString();
 				const auto value = attribute.value().toString();
@@ -347,7 +390,7 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 		case QXmlStreamReader::EndElement: {
 			if (!elementIds.isEmpty()) {
 				if (!elementIds.back().isEmpty()) {
-					contexts.pop_back();
+					CloseContext(contexts, infos, elements);
 				}
 				elementIds.pop_back();
 			}
@@ -361,7 +404,7 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 				auto targets = QList<QString>();
 				if (HasDisallowedCss(text, &targets)) {
 					LOG(("Svg Sanitize: Disallowed CSS."));
-					return {};
+					return false;
 				}
 				for (const auto &target : targets) {
 					infos[QString()].refs.push_back(
@@ -377,7 +420,7 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 					QLatin1String("<!ENTITY"),
 					Qt::CaseInsensitive)) {
 				LOG(("Svg Sanitize: Disallowed DTD entity declaration."));
-				return {};
+				return false;
 			}
 		} break;
 		case QXmlStreamReader::ProcessingInstruction: {
@@ -387,19 +430,22 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 					QLatin1String("xml-stylesheet"),
 					Qt::CaseInsensitive) == 0) {
 				LOG(("Svg Sanitize: Disallowed processing instruction."));
-				return {};
+				return false;
 			}
 		} break;
 		case QXmlStreamReader::EntityReference:
 		case QXmlStreamReader::Invalid:
 			LOG(("Svg Sanitize: Disallowed XML token."));
-			return {};
+			return false;
 		default: break;
 		}
 	}
 	if (reader.hasError() || !hasRoot) {
 		LOG(("Svg Sanitize: Parse error."));
-		return {};
+		return false;
+	}
+	while (!contexts.isEmpty()) {
+		CloseContext(contexts, infos, elements);
 	}
 	auto evaluator = GraphEvaluator(infos);
 	if ((evaluator.depthOf(QString(), 1) > kMaxRenderDepth)
@@ -407,9 +453,85 @@ QByteArray SanitizeSvg(const QByteArray &bytes) {
 		|| (evaluator.expansionOf(QString(), 1) > kMaxReferenceExpansion)
 		|| !evaluator.ok()) {
 		LOG(("Svg Sanitize: Reference graph too deep or too large."));
-		return {};
+		return false;
+	}
+	return true;
+}
+
+[[nodiscard]] std::optional<bool> LookupVerdict(
+		const QByteArray &bytes,
+		uint64 hash) {
+	QMutexLocker lock(&CachedVerdictsMutex);
+	const auto i = ranges::find_if(CachedVerdicts, [&](
+			const CachedVerdict &entry) {
+		return (entry.hash == hash) && (entry.bytes == bytes);
+	});
+	if (i == end(CachedVerdicts)) {
+		return std::nullopt;
+	}
+	const auto result = i->safe;
+	std::rotate(i, i + 1, end(CachedVerdicts));
+	return result;
+}
+
+void RememberVerdict(const QByteArray &bytes, uint64 hash, bool safe) {
+	QMutexLocker lock(&CachedVerdictsMutex);
+	if (CachedVerdicts.size() == kCachedVerdicts) {
+		CachedVerdicts.erase(begin(CachedVerdicts));
+	}
+	CachedVerdicts.push_back({ bytes, hash, safe });
+}
+
+struct SanitizeBatch {
+	std::vector<QByteArray> list;
+	Fn<void(int index, QByteArray result)> done;
+	std::atomic<int> next = 0;
+};
+
+} // namespace
+
+QByteArray SanitizeSvg(const QByteArray &bytes) {
+	if (bytes.size() > kMaxCachedSvgSize) {
+		return CheckSvg(bytes) ? bytes : QByteArray();
+	}
+	// The whole bytes are compared on hit, a hash collision can't make
+	// an unsafe document pass.
+	const auto hash = XXH64(bytes.constData(), bytes.size(), 0);
+	if (const auto safe = LookupVerdict(bytes, hash)) {
+		return *safe ? bytes : QByteArray();
+	}
+	const auto safe = CheckSvg(bytes);
+	RememberVerdict(bytes, hash, safe);
+	return safe ? bytes : QByteArray();
+}
+
+void SanitizeSvgs(
+		std::vector<QByteArray> list,
+		Fn<void(int index, QByteArray result)> done) {
+	Expects(done != nullptr);
+
+	const auto count = int(list.size());
+	const auto workers = std::min(
+		count,
+		std::clamp(QThread::idealThreadCount(), 1, kMaxSanitizeWorkers));
+	if (!workers) {
+		return;
+	}
+	const auto batch = std::make_shared<SanitizeBatch>();
+	batch->list = std::move(list);
+	batch->done = std::move(done);
+	for (auto i = 0; i != workers; ++i) {
+		crl::async([=] {
+			while (true) {
+				const auto index = batch->next++;
+				if (index >= count) {
+					break;
+				}
+				const auto bytes = base::take(batch->list[index]);
+				batch->done(index, SanitizeSvg(bytes));
+			}
+		});
 	}
-	return bytes;
 }
 
 } // namespace Images
@@ -6,6 +6,8 @@
 //
 #pragma once
 
+#include "base/basic_types.h"
+
 class QByteArray;
 
 namespace Images {
@@ -13,6 +15,12 @@ namespace Images {
 // Checks an SVG document against everything we know can crash or hang
 // QSvgRenderer (any Qt version) and returns the bytes unchanged if they
 // are safe to parse and render, or an empty array if they are not.
+// Recent verdicts are remembered, checking the same bytes again is cheap.
 [[nodiscard]] QByteArray SanitizeSvg(const QByteArray &bytes);
 
+// Sanitizes the list on a few background threads, done is called there.
+void SanitizeSvgs(
+	std::vector<QByteArray> list,
+	Fn<void(int index, QByteArray result)> done);
+
 } // namespace Images
@@ -94,6 +94,7 @@ void LayerStackWidget::BackgroundWidget::setCacheImages(
 		QPixmap &&mainMenuCache,
 		QPixmap &&specialLayerCache,
 		QPixmap &&layerCache) {
+	ReturnSnapshot(base::take(_bodyCache));
 	_bodyCache = std::move(bodyCache);
 	_mainMenuCache = std::move(mainMenuCache);
 	_specialLayerCache = std::move(specialLayerCache);
@@ -106,7 +107,7 @@ void LayerStackWidget::BackgroundWidget::setCacheImages(
 
 void LayerStackWidget::BackgroundWidget::removeBodyCache() {
 	if (hasBodyCache()) {
-		_bodyCache = {};
+		ReturnSnapshot(base::take(_bodyCache));
 		setAttribute(Qt::WA_OpaquePaintEvent, false);
 	}
 }
@@ -117,6 +118,7 @@ bool LayerStackWidget::BackgroundWidget::hasBodyCache() const {
 
 void LayerStackWidget::BackgroundWidget::refreshBodyCache(
 		QPixmap &&bodyCache) {
+	ReturnSnapshot(base::take(_bodyCache));
 	_bodyCache = std::move(bodyCache);
 	setAttribute(Qt::WA_OpaquePaintEvent, !_bodyCache.isNull());
 }
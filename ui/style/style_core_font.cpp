@@ -10,12 +10,21 @@
 #include "base/debug_log.h"
 #include "base/base_file_utilities.h"
 #include "ui/integration.h"
+#include "ui/style/style_core_scale.h"
 
+#include <crl/crl_async.h>
+#include <crl/crl_on_main.h>
+#include <QtCore/QCoreApplication>
 #include <QtCore/QMap>
 #include <QtCore/QVector>
 #include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QThread>
 #include <QtGui/QFontInfo>
 #include <QtGui/QFontDatabase>
+#include <QtGui/QRawFont>
+
+#include <xxhash.h>
 
 #if __has_include(<glib.h>)
 #include <glib.h>
@@ -42,6 +51,12 @@ namespace style {
 namespace {
 
 constexpr auto kSubSuperMultiplier = 0.75;
+constexpr auto kMetricsCacheVersion = 1;
+constexpr auto kMaxMetricsCacheSize = 1024 * 1024;
+constexpr auto kAdvanceFirst = ushort(0x20);
+constexpr auto kAdvanceLast = ushort(0x7E);
+constexpr auto kAdvanceCount = int(kAdvanceLast - kAdvanceFirst + 1);
+constexpr auto kUnknownKerning = std::numeric_limits<int16>::min();
 
 QString Custom;
 
@@ -85,6 +100,18 @@ base::flat_map<uint64, uint32> QtFontsKeys;
 		| uint32(flags.value());
 }
 
+[[nodiscard]] int FontKeySize(uint32 key) {
+	return int((key >> 6) & 0xFFFU);
+}
+
+[[nodiscard]] FontFlags FontKeyFlags(uint32 key) {
+	return FontFlag(key & 0x3FU);
+}
+
+[[nodiscard]] int FontKeyFamily(uint32 key) {
+	return int(key >> 18);
+}
+
 [[nodiscard]] uint64 QtFontKey(const QFont &font) {
 	static auto Families = base::flat_map<QString, int>();
 
@@ -301,6 +328,292 @@ struct Metrics {
 	}
 }
 
+struct ResolvedMetrics {
+	Metrics metrics;
+	bool forceBold = false;
+};
+
+[[nodiscard]] int FinalPixelSize(int pixelSize, FontFlags flags) {
+	const auto monospace = (flags & FontFlag::Monospace) != 0;
+	return (monospace || !(flags & FontFlag::SubOrSuper))
+		? pixelSize
+		: int(base::SafeRound(pixelSize * kSubSuperMultiplier));
+}
+
+// Thread-safe, used both from ResolveFont and from cache validation.
+[[nodiscard]] ResolvedMetrics ComputeResolvedMetrics(
+		QFont font,
+		FontFlags flags,
+		bool adjust) {
+	auto result = ResolvedMetrics{ .metrics = ComputeMetrics(font, adjust) };
+	const auto monospace = (flags & FontFlag::Monospace) != 0;
+	if (!monospace && (flags & FontFlag::Bold)) {
+		font.setPixelSize(FinalPixelSize(result.metrics.pixelSize, flags));
+		font.setWeight(QFont::DemiBold);
+		const auto style = QFontInfo(font).styleName();
+		result.forceBold = !style.isEmpty()
+			&& !style.startsWith("Semibold", Qt::CaseInsensitive);
+	}
+	return result;
+}
+
+struct CachedMetricsRecord {
+	uint64 key = 0;
+	int32 pixelSize = 0;
+	int32 forceBold = 0;
+	float64 ascent = 0.;
+	float64 height = 0.;
+};
+
+struct CachedMetricsHeader {
+	int32 version = 0;
+	int32 count = 0;
+};
+
+struct MetricsToValidate {
+	uint64 key = 0;
+	QFont font;
+	FontFlags flags;
+	bool adjust = false;
+};
+
+struct MetricsCache {
+	bool loaded = false;
+	bool writeScheduled = false;
+	bool validateScheduled = false;
+	QString folder;
+	base::flat_map<uint64, ResolvedMetrics> entries;
+	base::flat_map<QString, uint64> identities;
+	std::vector<MetricsToValidate> validate;
+};
+
+MetricsCache FontMetricsCache;
+
+[[nodiscard]] QString MetricsCacheFolder() {
+	const auto base = Integration::Instance().emojiCacheFolder();
+	return base.isEmpty() ? QString() : (base + "/fonts");
+}
+
+[[nodiscard]] QByteArray SerializeMetricsCache(
+		const base::flat_map<uint64, ResolvedMetrics> &entries) {
+	const auto header = CachedMetricsHeader{
+		.version = kMetricsCacheVersion,
+		.count = int32(entries.size()),
+	};
+	auto result = QByteArray();
+	result.reserve(sizeof(header)
+		+ entries.size() * sizeof(CachedMetricsRecord));
+	result.append(
+		reinterpret_cast<const char*>(&header),
+		sizeof(header));
+	for (const auto &[key, resolved] : entries) {
+		const auto record = CachedMetricsRecord{
+			.key = key,
+			.pixelSize = resolved.metrics.pixelSize,
+			.forceBold = resolved.forceBold ? 1 : 0,
+			.ascent = resolved.metrics.ascent,
+			.height = resolved.metrics.height,
+		};
+		result.append(
+			reinterpret_cast<const char*>(&record),
+			sizeof(record));
+	}
+	return result;
+}
+
+void LoadMetricsCache() {
+	auto &cache = FontMetricsCache;
+	if (cache.loaded || !Integration::Exists()) {
+		return;
+	}
+	cache.loaded = true;
+	cache.folder = MetricsCacheFolder();
+	if (cache.folder.isEmpty()) {
+		return;
+	}
+	auto file = QFile(cache.folder + "/metrics");
+	if (!file.open(QIODevice::ReadOnly)
+		|| file.size() > kMaxMetricsCacheSize) {
+		return;
+	}
+	const auto bytes = file.readAll();
+	auto header = CachedMetricsHeader();
+	if (bytes.size() < qsizetype(sizeof(header))) {
+		return;
+	}
+	memcpy(&header, bytes.constData(), sizeof(header));
+	if (header.version != kMetricsCacheVersion
+		|| header.count < 0
+		|| (bytes.size() != qsizetype(sizeof(header))
+			+ header.count * qsizetype(sizeof(CachedMetricsRecord)))) {
+		return;
+	}
+	auto entries = base::flat_map<uint64, ResolvedMetrics>();
+	auto data = bytes.constData() + sizeof(header);
+	for (auto i = 0; i != header.count; ++i) {
+		auto record = CachedMetricsRecord();
+		memcpy(&record, data, sizeof(record));
+		data += sizeof(record);
+		if (record.pixelSize <= 0) {
+			return;
+		}
+		entries.emplace(record.key, ResolvedMetrics{
+			.metrics = {
+				.pixelSize = record.pixelSize,
+				.ascent = record.ascent,
+				.height = record.height,
+			},
+			.forceBold = (record.forceBold != 0),
+		});
+	}
+	cache.entries = std::move(entries);
+}
+
+void WriteMetricsCache() {
+	auto &cache = FontMetricsCache;
+	cache.writeScheduled = false;
+	if (cache.folder.isEmpty()) {
+		return;
+	}
+	crl::async([
+		folder = cache.folder,
+		bytes = SerializeMetricsCache(cache.entries)
+	] {
+		if (!QDir().mkpath(folder)) {
+			return;
+		}
+		auto file = QFile(folder + "/metrics");
+		if (file.open(QIODevice::WriteOnly)) {
+			file.write(bytes);
+		}
+	});
+}
+
+void ScheduleMetricsCacheWrite() {
+	auto &cache = FontMetricsCache;
+	if (cache.writeScheduled || cache.folder.isEmpty()) {
+		return;
+	}
+	cache.writeScheduled = true;
+
+	// Fonts are resolved on first use, often many in one event loop
+	// iteration, so we write the whole file once after that.
+	Integration::Instance().postponeCall(WriteMetricsCache);
+}
+
+void ApplyValidatedMetrics(
+		std::vector<std::pair<uint64, ResolvedMetrics>> computed) {
+	auto &cache = FontMetricsCache;
+	auto changed = false;
+	for (const auto &[key, resolved] : computed) {
+		auto &entry = cache.entries[key];
+		if (entry.metrics.pixelSize != resolved.metrics.pixelSize
+			|| entry.metrics.ascent != resolved.metrics.ascent
+			|| entry.metrics.height != resolved.metrics.height
+			|| entry.forceBold != resolved.forceBold) {
+			entry = resolved;
+			changed = true;
+		}
+	}
+	if (changed) {
+		// Fonts already created keep the stale metrics until restart.
+		LOG(("Font: cached metrics mismatch, rewriting cache."));
+		ScheduleMetricsCacheWrite();
+	}
+}
+
+void ValidateMetricsCache() {
+	auto &cache = FontMetricsCache;
+	cache.validateScheduled = false;
+	crl::async([validate = base::take(cache.validate)] {
+		auto computed = std::vector<std::pair<uint64, ResolvedMetrics>>();
+		computed.reserve(validate.size());
+		for (const auto &entry : validate) {
+			computed.emplace_back(
+				entry.key,
+				ComputeResolvedMetrics(
+					entry.font,
+					entry.flags,
+					entry.adjust));
+		}
+		crl::on_main([computed = std::move(computed)]() mutable {
+			ApplyValidatedMetrics(std::move(computed));
+		});
+	});
+}
+
+void ScheduleMetricsCacheValidation(MetricsToValidate &&entry) {
+	auto &cache = FontMetricsCache;
+	cache.validate.push_back(std::move(entry));
+	if (cache.validateScheduled) {
+		return;
+	}
+	cache.validateScheduled = true;
+	Integration::Instance().postponeCall(ValidateMetricsCache);
+}
+
+// Changes when the font file behind the family changes.
+[[nodiscard]] uint64 FontIdentity(const QFont &font) {
+	auto &identities = FontMetricsCache.identities;
+	const auto family = font.family();
+	const auto i = identities.find(family);
+	if (i != end(identities)) {
+		return i->second;
+	}
+	const auto raw = QRawFont::fromFont(font);
+	const auto head = raw.fontTable("head");
+	const auto name = raw.familyName() + '\n' + raw.styleName();
+	const auto seed = XXH64(head.constData(), head.size(), 0);
+	const auto result = XXH64(
+		name.constData(),
+		name.size() * sizeof(QChar),
+		seed);
+	identities.emplace(family, result);
+	return result;
+}
+
+[[nodiscard]] uint64 MetricsCacheKey(
+		const QFont &font,
+		FontFlags flags,
+		int size) {
+	const auto family = font.family();
+	const auto parts = std::array<int32, 4>{
+		int32(flags.value()),
+		int32(size),
+		int32(DevicePixelRatio()),
+		int32(kMetricsCacheVersion),
+	};
+	const auto seed = XXH64(parts.data(), sizeof(parts), FontIdentity(font));
+	return XXH64(family.constData(), family.size() * sizeof(QChar), seed);
+}
+
+[[nodiscard]] ResolvedMetrics ResolveMetrics(
+		const QFont &font,
+		FontFlags flags,
+		bool adjust) {
+	LoadMetricsCache();
+
+	auto &cache = FontMetricsCache;
+	if (cache.folder.isEmpty()) {
+		return ComputeResolvedMetrics(font, flags, adjust);
+	}
+	const auto key = MetricsCacheKey(font, flags, font.pixelSize());
+	const auto i = cache.entries.find(key);
+	if (i != end(cache.entries)) {
+		ScheduleMetricsCacheValidation({
+			.key = key,
+			.font = font,
+			.flags = flags,
+			.adjust = adjust,
+		});
+		return i->second;
+	}
+	const auto result = ComputeResolvedMetrics(font, flags, adjust);
+	cache.entries.emplace(key, result);
+	ScheduleMetricsCacheWrite();
+	return result;
+}
+
 [[nodiscard]] FontResolveResult ResolveFont(
 		const QString &family,
 		FontFlags flags,
@@ -321,25 +634,16 @@ struct Metrics {
 	font.setPixelSize(size);
 
 	const auto adjust = (overriden || system);
-	const auto metrics = ComputeMetrics(font, adjust);
+	const auto resolved = ResolveMetrics(font, flags, adjust);
+	const auto &metrics = resolved.metrics;
 
-	if (monospace || !(flags & FontFlag::SubOrSuper)) {
-		font.setPixelSize(metrics.pixelSize);
-	} else {
-		font.setPixelSize(
-			int(base::SafeRound(metrics.pixelSize * kSubSuperMultiplier)));
-	}
+	font.setPixelSize(FinalPixelSize(metrics.pixelSize, flags));
 	if (!monospace) {
 		font.setWeight((flags & FontFlag::Bold)
 			? QFont::DemiBold
 			: QFont::Normal);
-		if (font.bold()) {
-			const auto style = QFontInfo(font).styleName();
-			if (!style.isEmpty() && !style.startsWith(
-					"Semibold",
-					Qt::CaseInsensitive)) {
-				font.setBold(true);
-			}
+		if (resolved.forceBold) {
+			font.setBold(true);
 		}
 
 		font.setItalic(flags & FontFlag::Italic);
@@ -369,6 +673,7 @@ void StartFonts() {
 	Started = true;
 
 	style_InitFontsResource();
+	LoadMetricsCache();
 
 	const auto name = u"Open Sans"_q;
 
@@ -442,6 +747,96 @@ FontData::FontData(const FontResolveResult &result, FontVariants *modified)
 	fleading = QFixed::fromReal(_m.leading());
 }
 
+// Widths of printable ASCII strings without the shaping, as a sum of the
+// advances of characters and the kerning of each pair of them.
+//
+// This treats all the shaping as pairwise: contextual kerning, contextual
+// alternates and ligatures of three characters or more are not described
+// by it. Only "ffi" and "ffl" are checked when the table is created, any
+// font that shapes them differently keeps using horizontalAdvance.
+struct FontData::Advances {
+	using KerningRow = std::array<int16, kAdvanceCount>;
+
+	std::array<float64, kAdvanceCount> single = {};
+	// In 1/64 of a pixel, rows by the first character, created on demand.
+	std::array<std::unique_ptr<KerningRow>, kAdvanceCount> kerning;
+	bool failed = false;
+};
+
+int FontData::width(QStringView text) const {
+	if (const auto result = cachedWidth(text)) {
+		return int(std::ceil(*result));
+	}
+	return int(std::ceil(_m.horizontalAdvance(text.toString())));
+}
+
+std::optional<float64> FontData::cachedWidth(QStringView text) const {
+	// The tables are accessed only from the main thread.
+	const auto app = QCoreApplication::instance();
+	if (!app || QThread::currentThread() != app->thread()) {
+		return std::nullopt;
+	} else if (text.isEmpty() || (_advances && _advances->failed)) {
+		return std::nullopt;
+	}
+	for (const auto ch : text) {
+		const auto code = ch.unicode();
+		if (code < kAdvanceFirst || code > kAdvanceLast) {
+			return std::nullopt;
+		}
+	}
+	const auto single = [&](int index) {
+		auto &result = _advances->single[index];
+		if (!result) {
+			const auto ch = QChar(ushort(kAdvanceFirst + index));
+			result = _m.horizontalAdvance(QString(ch));
+		}
+		return result;
+	};
+	const auto pair = [&](int first, int second) {
+		auto &row = _advances->kerning[first];
+		if (!row) {
+			row = std::make_unique<Advances::KerningRow>();
+			row->fill(kUnknownKerning);
+		}
+		auto &result = (*row)[second];
+		if (result == kUnknownKerning) {
+			const auto chars = std::array{
+				QChar(ushort(kAdvanceFirst + first)),
+				QChar(ushort(kAdvanceFirst + second)),
+			};
+			const auto both = _m.horizontalAdvance(QString(chars.data(), 2));
+			result = int16(base::SafeRound(
+				(both - single(first) - single(second)) * 64.));
+		}
+		return result / 64.;
+	};
+	const auto compute = [&](QStringView text) {
+		auto result = 0.;
+		auto previous = -1;
+		for (const auto ch : text) {
+			const auto index = int(ch.unicode() - kAdvanceFirst);
+			result += single(index);
+			if (previous >= 0) {
+				result += pair(previous, index);
+			}
+			previous = index;
+		}
+		return result;
+	};
+	if (!_advances) {
+		_advances = std::make_shared<Advances>();
+
+		// Pairs don't describe ligatures of three characters or more.
+		for (const auto check : { u"ffi"_q, u"ffl"_q }) {
+			if (compute(check) != _m.horizontalAdvance(check)) {
+				_advances->failed = true;
+				return std::nullopt;
+			}
+		}
+	}
+	return compute(text);
+}
+
 Font FontData::bold(bool set) const {
 	return otherFlagsFont(FontFlag::Bold, set);
 }
@@ -490,23 +885,27 @@ Font FontData::otherFlagsFont(FontFlag flag, bool set) const {
 	return _modified[newFlags];
 }
 
-Font::Font(int size, FontFlags flags, const QString &family) {
-	init(size, flags, RegisterFontFamily(family), 0);
+Font::Font(int size, FontFlags flags, const QString &family)
+: _key(FontKey(size, flags, RegisterFontFamily(family))) {
 }
 
-Font::Font(int size, FontFlags flags, int family) {
-	init(size, flags, family, 0);
+Font::Font(int size, FontFlags flags, int family)
+: _key(FontKey(size, flags, family)) {
 }
 
 Font::Font(int size, FontFlags flags, int family, FontVariants *modified) {
 	init(size, flags, family, modified);
 }
 
+void Font::resolve() const {
+	init(FontKeySize(_key), FontKeyFlags(_key), FontKeyFamily(_key), 0);
+}
+
 void Font::init(
 		int size,
 		FontFlags flags,
 		int family,
-		FontVariants *modified) {
+		FontVariants *modified) const {
 	const auto key = FontKey(size, flags, family);
 	auto i = FontsByKey.find(key);
 	if (i == end(FontsByKey)) {
@@ -64,18 +64,22 @@ class Font final {
 public:
 	constexpr Font(Qt::Initialization = Qt::Uninitialized) {
 	}
+	// The font is resolved and created on first use.
 	Font(int size, FontFlags flags, const QString &family);
 	Font(int size, FontFlags flags, int family);
 
 	[[nodiscard]] FontData *operator->() const {
-		return _data;
+		return get();
 	}
 	[[nodiscard]] FontData *get() const {
+		if (!_data && _key) {
+			resolve();
+		}
 		return _data;
 	}
 
 	[[nodiscard]] operator bool() const {
-		return _data != nullptr;
+		return get() != nullptr;
 	}
 
 	[[nodiscard]] operator const QFont &() const;
@@ -84,9 +88,15 @@ private:
 	friend class FontData;
 	friend class OwnedFont;
 
-	FontData *_data = nullptr;
+	mutable FontData *_data = nullptr;
+	uint32 _key = 0; // Of the font to create on first use.
 
-	void init(int size, FontFlags flags, int family, FontVariants *modified);
+	void init(
+		int size,
+		FontFlags flags,
+		int family,
+		FontVariants *modified) const;
+	void resolve() const;
 	friend void StartManager();
 
 	explicit Font(FontData *data) : _data(data) {
@@ -98,11 +108,12 @@ private:
 class FontData {
 public:
 	[[nodiscard]] int width(const QString &text) const {
-		return int(std::ceil(_m.horizontalAdvance(text)));
+		return width(QStringView(text));
 	}
 	[[nodiscard]] int width(const QString &text, int from, int to) const {
-		return width(text.mid(from, to));
+		return width(QStringView(text).mid(from, to));
 	}
+	[[nodiscard]] int width(QStringView text) const;
 	[[nodiscard]] int width(QChar ch) const {
 		return int(std::ceil(_m.horizontalAdvance(ch)));
 	}
@@ -143,10 +154,14 @@ private:
 
 	mutable FontVariants _modified;
 
+	struct Advances;
+
 	[[nodiscard]] Font otherFlagsFont(FontFlag flag, bool set) const;
+	[[nodiscard]] std::optional<float64> cachedWidth(QStringView text) const;
 	FontData(const FontResolveResult &data, FontVariants *modified);
 
 	QFontMetricsF _m;
+	mutable std::shared_ptr<Advances> _advances;
 	int _size = 0;
 	int _family = 0;
 	FontFlags _flags = 0;
@@ -161,7 +176,7 @@ inline bool operator!=(const Font &a, const Font &b) {
 }
 
 inline Font::operator const QFont &() const {
-	Expects(_data != nullptr);
+	Expects(get() != nullptr);
 
 	return _data->f;
 }
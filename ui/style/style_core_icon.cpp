@@ -11,10 +11,17 @@
 #include "ui/painter.h"
 #include "base/basic_types.h"
 
+#include <crl/crl_async.h>
+
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMutex>
+#include <QtCore/QThread>
 #include <QtGui/QPainter>
 #include <QtSvg/QSvgRenderer>
 
+#include <array>
+#include <atomic>
+
 namespace style {
 namespace internal {
 namespace {
@@ -26,8 +33,44 @@ namespace {
 		| uint32(c.alpha());
 }
 
-base::flat_map<const IconMask*, QImage> IconMasks;
-QMutex IconMasksMutex;
+// Masks are resolved both on the main thread and by PrewarmIcons()
+// workers, so the map is split to keep them from waiting on each other.
+constexpr auto kIconMaskShards = 16;
+constexpr auto kMaxPrewarmWorkers = 2;
+
+struct ResolvedIconMask {
+	QImage image;
+	int scale = 0;
+	int ratio = 0;
+};
+
+struct IconMaskShard {
+	QMutex mutex;
+	base::flat_map<const IconMask*, ResolvedIconMask> masks;
+};
+
+std::array<IconMaskShard, kIconMaskShards> IconMaskShards;
+
+Fn<void(not_null<const IconMask*>, int64)> IconMaskDecoded;
+QMutex IconMaskDecodedMutex;
+
+[[nodiscard]] IconMaskShard &IconMaskShardFor(const IconMask *mask) {
+	return IconMaskShards[(quintptr(mask) >> 4) % kIconMaskShards];
+}
+
+// Rendering SVG masks is expensive and instance() with a custom scale
+// or paint() of a not yet loaded icon may ask for the same one often.
+constexpr auto kSvgMasksCached = 32;
+
+struct SvgMask {
+	const IconMask *mask = nullptr;
+	int scale = 0;
+	int ratio = 0;
+	QImage image;
+};
+
+std::vector<SvgMask> SvgMasks;
+QMutex SvgMasksMutex;
 
 base::flat_map<QPair<const IconMask*, uint32>, QPixmap> iconPixmaps;
 base::flat_set<IconData*> iconData;
@@ -35,7 +78,42 @@ base::flat_set<IconData*> iconData;
 [[nodiscard]] QImage CreateIconMask(
 		not_null<const IconMask*> mask,
 		int scale,
-		bool ignoreDpr = false) {
+		bool ignoreDpr = false);
+
+[[nodiscard]] QImage CachedSvgMask(
+		not_null<const IconMask*> mask,
+		int scale,
+		int ratio) {
+	QMutexLocker lock(&SvgMasksMutex);
+	const auto i = ranges::find_if(SvgMasks, [&](const SvgMask &entry) {
+		return (entry.mask == mask)
+			&& (entry.scale == scale)
+			&& (entry.ratio == ratio);
+	});
+	if (i == end(SvgMasks)) {
+		return QImage();
+	}
+	auto result = i->image;
+	std::rotate(i, i + 1, end(SvgMasks));
+	return result;
+}
+
+void RememberSvgMask(
+		not_null<const IconMask*> mask,
+		int scale,
+		int ratio,
+		const QImage &image) {
+	QMutexLocker lock(&SvgMasksMutex);
+	if (SvgMasks.size() == kSvgMasksCached) {
+		SvgMasks.erase(begin(SvgMasks));
+	}
+	SvgMasks.push_back({ mask, scale, ratio, image });
+}
+
+QImage CreateIconMask(
+		not_null<const IconMask*> mask,
+		int scale,
+		bool ignoreDpr) {
 	const auto ratio = ignoreDpr ? 1 : DevicePixelRatio();
 	const auto realscale = scale * ratio;
 
@@ -43,6 +121,9 @@ base::flat_set<IconData*> iconData;
 		reinterpret_cast<const char*>(mask->data()),
 		mask->size());
 	if (data.startsWith("SVG:")) {
+		if (auto cached = CachedSvgMask(mask, scale, ratio); !cached.isNull()) {
+			return cached;
+		}
 		auto size = mask->rendered();
 		data = QByteArray::fromRawData(
 			data.constData() + 4,
@@ -78,9 +159,12 @@ base::flat_set<IconData*> iconData;
 			QImage::Format_ARGB32_Premultiplied);
 		maskImage.fill(Qt::transparent);
 		maskImage.setDevicePixelRatio(ratio);
-		auto p = QPainter(&maskImage);
-		auto hq = PainterHighQualityEnabler(p);
-		svg.render(&p, QRectF(0, 0, width, height));
+		{
+			auto p = QPainter(&maskImage);
+			auto hq = PainterHighQualityEnabler(p);
+			svg.render(&p, QRectF(0, 0, width, height));
+		}
+		RememberSvgMask(mask, scale, ratio, maskImage);
 		return maskImage;
 	}
 
@@ -113,14 +197,36 @@ base::flat_set<IconData*> iconData;
 }
 
 [[nodiscard]] QImage ResolveIconMask(not_null<const IconMask*> mask) {
-	QMutexLocker lock(&IconMasksMutex);
-	if (const auto i = IconMasks.find(mask); i != end(IconMasks)) {
-		return i->second;
+	const auto scale = Scale();
+	const auto ratio = DevicePixelRatio();
+	auto &shard = IconMaskShardFor(mask);
+	{
+		QMutexLocker lock(&shard.mutex);
+		const auto i = shard.masks.find(mask);
+		if (i != end(shard.masks)
+			&& i->second.scale == scale
+			&& i->second.ratio == ratio) {
+			return i->second.image;
+		}
+	}
+
+	// Decode without holding the lock, the same mask being decoded twice
+	// by a prewarm worker and the main thread is cheaper than waiting.
+	auto timer = QElapsedTimer();
+	timer.start();
+	auto image = CreateIconMask(mask, scale);
+	const auto elapsed = timer.nsecsElapsed() / 1000;
+	{
+		QMutexLocker lock(&IconMaskDecodedMutex);
+		if (const auto callback = IconMaskDecoded) {
+			lock.unlock();
+			callback(mask, elapsed);
+		}
 	}
-	return IconMasks.emplace(
-		mask,
-		CreateIconMask(mask, Scale())
-	).first->second;
+
+	QMutexLocker lock(&shard.mutex);
+	shard.masks[mask] = { image, scale, ratio };
+	return image;
 }
 
 [[nodiscard]] QSize readGeneratedSize(
@@ -452,6 +558,14 @@ QImage IconData::instance(
 	return _parts[0].instance(colorOverride, scale, ignoreDpr);
 }
 
+void IconData::collectMasks(std::vector<const IconMask*> &masks) const {
+	for (const auto &part : _parts) {
+		if (const auto mask = part.mask()) {
+			masks.push_back(mask);
+		}
+	}
+}
+
 int IconData::width() const {
 	if (_width < 0) {
 		_width = 0;
@@ -511,8 +625,56 @@ void DestroyIcons() {
 	iconData.clear();
 	iconPixmaps.clear();
 
-	QMutexLocker lock(&IconMasksMutex);
-	IconMasks.clear();
+	for (auto &shard : IconMaskShards) {
+		QMutexLocker lock(&shard.mutex);
+		shard.masks.clear();
+	}
+	QMutexLocker lock(&SvgMasksMutex);
+	SvgMasks.clear();
+}
+
+void PrewarmIcons(std::vector<not_null<const Icon*>> icons) {
+	auto masks = std::vector<const IconMask*>();
+	for (const auto icon : icons) {
+		icon->collectMasks(masks);
+	}
+	ranges::sort(masks);
+	masks.erase(ranges::unique(masks), end(masks));
+	masks.erase(ranges::remove_if(masks, [](const IconMask *mask) {
+		return !readGeneratedSize(mask, Scale()).isEmpty();
+	}), end(masks));
+
+	const auto count = int(masks.size());
+	const auto workers = std::min(
+		count,
+		std::clamp(QThread::idealThreadCount() - 1, 1, kMaxPrewarmWorkers));
+	if (!workers) {
+		return;
+	}
+	struct Batch {
+		std::vector<const IconMask*> masks;
+		std::atomic<int> next = 0;
+	};
+	const auto batch = std::make_shared<Batch>();
+	batch->masks = std::move(masks);
+	for (auto i = 0; i != workers; ++i) {
+		crl::async([=] {
+			while (true) {
+				const auto index = batch->next++;
+				if (index >= count) {
+					break;
+				}
+				[[maybe_unused]] const auto image = ResolveIconMask(
+					batch->masks[index]);
+			}
+		});
+	}
+}
+
+void SetIconMaskDecodedCallback(
+		Fn<void(not_null<const IconMask*> mask, int64 microseconds)> callback) {
+	QMutexLocker lock(&IconMaskDecodedMutex);
+	IconMaskDecoded = std::move(callback);
 }
 
 } // namespace internal
@@ -88,6 +88,10 @@ public:
 		int scale,
 		bool ignoreDpr) const;
 
+	[[nodiscard]] const IconMask *mask() const {
+		return _mask;
+	}
+
 	~MonoIcon() {
 	}
 
@@ -164,6 +168,8 @@ public:
 		int scale,
 		bool ignoreDpr) const;
 
+	void collectMasks(std::vector<const IconMask*> &masks) const;
+
 	int width() const;
 	int height() const;
 
@@ -329,6 +335,10 @@ public:
 
 	Icon withPalette(const style::palette &palette) const;
 
+	void collectMasks(std::vector<const IconMask*> &masks) const {
+		_data->collectMasks(masks);
+	}
+
 	~Icon() {
 		if (auto data = base::take(_data)) {
 			if (_owner) {
@@ -382,5 +392,13 @@ private:
 void ResetIcons();
 void DestroyIcons();
 
+// Decodes masks of the icons on background threads, so that the first
+// paint finds them ready. Call when a screen using them is about to open.
+void PrewarmIcons(std::vector<not_null<const Icon*>> icons);
+
+// Called on the decoding thread after each mask is decoded.
+void SetIconMaskDecodedCallback(
+	Fn<void(not_null<const IconMask*> mask, int64 microseconds)> callback);
+
 } // namespace internal
 } // namespace style
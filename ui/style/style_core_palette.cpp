@@ -8,7 +8,42 @@
 
 #include "ui/style/style_palette_colorizer.h"
 
+#include <QtCore/QtEndian>
+
+#include <array>
+
 namespace style {
+namespace {
+
+// Versioned cache layout: magic, version, color count, RGBA bytes.
+constexpr auto kBinaryMagic = std::array<char, 4>{ { 'P', 'A', 'L', 'B' } };
+constexpr auto kBinaryVersion = quint32(1);
+constexpr auto kBinaryHeader = int(kBinaryMagic.size() + 2 * sizeof(quint32));
+
+[[nodiscard]] quint32 ReadUInt32(const char *data) {
+	auto result = quint32();
+	memcpy(&result, data, sizeof(result));
+	return qFromLittleEndian(result);
+}
+
+void WriteUInt32(char *data, quint32 value) {
+	value = qToLittleEndian(value);
+	memcpy(data, &value, sizeof(value));
+}
+
+[[nodiscard]] bool SameColor(
+		const internal::ColorData &data,
+		uchar r,
+		uchar g,
+		uchar b,
+		uchar a) {
+	return (data.c.red() == r)
+		&& (data.c.green() == g)
+		&& (data.c.blue() == b)
+		&& (data.c.alpha() == a);
+}
+
+} // namespace
 
 struct palette::FinalizeHelper {
 	not_null<const colorizer*> with;
@@ -58,7 +93,7 @@ palette &palette::operator=(const palette &other) {
 		if (other._status[i] != Status::Initial) {
 			if (_status[i] == Status::Initial) {
 				new (data(i)) internal::ColorData(*other.data(i));
-			} else {
+			} else if (data(i)->c != other.data(i)->c) {
 				*data(i) = *other.data(i);
 			}
 			_status[i] = Status::Loaded;
@@ -89,18 +124,61 @@ QByteArray palette::save() const {
 	return result;
 }
 
-bool palette::load(const QByteArray &cache) {
-	if (cache.size() != kCount * 4) {
-		return false;
+QByteArray palette::saveBinary() const {
+	if (!_ready) {
+		const_cast<palette*>(this)->finalize();
 	}
 
-	auto p = reinterpret_cast<const uchar*>(cache.constData());
+	auto result = QByteArray(kBinaryHeader + kCount * 4, Qt::Uninitialized);
+	const auto bytes = result.data();
+	memcpy(bytes, kBinaryMagic.data(), kBinaryMagic.size());
+	WriteUInt32(bytes + kBinaryMagic.size(), kBinaryVersion);
+	WriteUInt32(bytes + kBinaryMagic.size() + sizeof(quint32), kCount);
+	auto rgba = reinterpret_cast<uchar*>(bytes + kBinaryHeader);
 	for (auto i = 0; i != kCount; ++i) {
-		setData(i, { p[i * 4 + 0], p[i * 4 + 1], p[i * 4 + 2], p[i * 4 + 3] });
+		const auto &c = data(i)->c;
+		*rgba++ = uchar(c.red());
+		*rgba++ = uchar(c.green());
+		*rgba++ = uchar(c.blue());
+		*rgba++ = uchar(c.alpha());
 	}
+	return result;
+}
+
+bool palette::load(const QByteArray &cache) {
+	if (cache.size() == kBinaryHeader + kCount * 4
+		&& !memcmp(cache.constData(), kBinaryMagic.data(), kBinaryMagic.size())) {
+		const auto bytes = cache.constData();
+		const auto version = ReadUInt32(bytes + kBinaryMagic.size());
+		const auto count = ReadUInt32(
+			bytes + kBinaryMagic.size() + sizeof(quint32));
+		if (version != kBinaryVersion || count != quint32(kCount)) {
+			return false;
+		}
+		loadColors(reinterpret_cast<const uchar*>(bytes + kBinaryHeader));
+		return true;
+	} else if (cache.size() != kCount * 4) {
+		return false;
+	}
+	loadColors(reinterpret_cast<const uchar*>(cache.constData()));
 	return true;
 }
 
+void palette::loadColors(const uchar *rgba) {
+	for (auto i = 0; i != kCount; ++i, rgba += 4) {
+		if (_status[i] == Status::Initial) {
+			new (data(i)) internal::ColorData(
+				rgba[0],
+				rgba[1],
+				rgba[2],
+				rgba[3]);
+		} else if (!SameColor(*data(i), rgba[0], rgba[1], rgba[2], rgba[3])) {
+			data(i)->set(rgba[0], rgba[1], rgba[2], rgba[3]);
+		}
+		_status[i] = Status::Loaded;
+	}
+}
+
 palette::SetResult palette::setColor(QLatin1String name, uchar r, uchar g, uchar b, uchar a) {
 	auto nameIndex = internal::GetPaletteIndex(name);
 	if (nameIndex < 0) return SetResult::KeyNotFound;
@@ -182,7 +260,7 @@ void palette::compute(int index, int fallbackIndex, TempColorData value) {
 void palette::setData(int index, const internal::ColorData &value) {
 	if (_status[index] == Status::Initial) {
 		new (data(index)) internal::ColorData(value);
-	} else {
+	} else if (data(index)->c != value.c) {
 		*data(index) = value;
 	}
 	_status[index] = Status::Loaded;
@@ -224,6 +302,10 @@ QByteArray save() {
 	return GetMutable().save();
 }
 
+QByteArray saveBinary() {
+	return GetMutable().saveBinary();
+}
+
 bool load(const QByteArray &cache) {
 	if (GetMutable().load(cache)) {
 		style::internal::ResetIcons();
@@ -23,6 +23,9 @@ public:
 	QByteArray save() const;
 	bool load(const QByteArray &cache);
 
+	// Same colors with a version and count header, load() accepts both.
+	[[nodiscard]] QByteArray saveBinary() const;
+
 	enum class SetResult {
 		Ok,
 		KeyNotFound,
@@ -51,6 +54,7 @@ private:
 		-> std::unique_ptr<FinalizeHelper>;
 
 	void clear();
+	void loadColors(const uchar *rgba);
 	void compute(int index, int fallbackIndex, TempColorData value);
 	void setData(int index, const internal::ColorData &value);
 
@@ -63,6 +67,7 @@ namespace main_palette {
 
 not_null<const palette*> get();
 QByteArray save();
+QByteArray saveBinary();
 bool load(const QByteArray &cache);
 palette::SetResult setColor(QLatin1String name, uchar r, uchar g, uchar b, uchar a);
 palette::SetResult setColor(QLatin1String name, QLatin1String from);
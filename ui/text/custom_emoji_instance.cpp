@@ -6,13 +6,14 @@
 //
 #include "ui/text/custom_emoji_instance.h"
 
+#include "ui/text/custom_emoji_render_queue.h"
+
 #include "ui/effects/animation_value.h"
 #include "ui/effects/frame_generator.h"
 #include "ui/dynamic_image.h"
 #include "ui/ui_utility.h"
 #include "ui/painter.h"
 
-#include <crl/crl_async.h>
 #include <lz4.h>
 
 class QPainter;
@@ -22,7 +23,11 @@ namespace {
 
 constexpr auto kMaxFrames = 180;
 constexpr auto kCacheVersion = 1;
+constexpr auto kDeltaCacheVersion = 2;
+constexpr auto kKeyframeInterval = 30;
+constexpr auto kTileSize = 16;
 constexpr auto kPreloadFrames = 3;
+constexpr auto kVisibleTimeout = crl::time(200);
 
 struct CacheHeader {
 	int version = 0;
@@ -31,6 +36,36 @@ struct CacheHeader {
 	int length = 0;
 };
 
+// Version 2 stores frames one by one, each one either a keyframe or a xor
+// with the previous frame limited to the changed tiles, compressed alone.
+// The base length stays zero so that readers that know only the version 1
+// atlas reject such cache instead of decompressing it as an atlas.
+struct DeltaCacheHeader {
+	CacheHeader base;
+	int payload = 0;
+};
+
+struct DeltaFrameHeader {
+	int keyframe = 0;
+	int length = 0;
+	int original = 0;
+};
+
+[[nodiscard]] int TilesPerSide(int size) {
+	return (size + kTileSize - 1) / kTileSize;
+}
+
+[[nodiscard]] int TilesMaskSize(int size) {
+	const auto perSide = TilesPerSide(size);
+	return (perSide * perSide + 7) / 8;
+}
+
+void XorBytes(uchar *to, const uchar *a, const uchar *b, int count) {
+	for (auto i = 0; i != count; ++i) {
+		to[i] = a[i] ^ b[i];
+	}
+}
+
 void PaintScaledImage(
 		QPainter &p,
 		const QRect &target,
@@ -173,8 +208,12 @@ std::optional<Cache> Cache::FromSerialized(
 	}
 	auto header = CacheHeader();
 	memcpy(&header, serialized.data(), sizeof(header));
+	if (header.version == kDeltaCacheVersion) {
+		return FromSerializedDelta(serialized, requestedSize);
+	}
 	const auto size = header.size;
-	if (size != requestedSize
+	if (header.version != kCacheVersion
+		|| size != requestedSize
 		|| header.frames <= 0
 		|| header.frames >= kMaxFrames
 		|| header.length <= 0
@@ -214,39 +253,286 @@ std::optional<Cache> Cache::FromSerialized(
 	return result;
 }
 
+std::optional<Cache> Cache::FromSerializedDelta(
+		const QByteArray &serialized,
+		int requestedSize) {
+	if (serialized.size() <= sizeof(DeltaCacheHeader)) {
+		return {};
+	}
+	auto header = DeltaCacheHeader();
+	memcpy(&header, serialized.data(), sizeof(header));
+	const auto size = header.base.size;
+	const auto frames = header.base.frames;
+	if (size != requestedSize
+		|| size <= 0
+		|| frames <= 0
+		|| frames >= kMaxFrames
+		|| header.base.length != 0
+		|| header.payload <= 0
+		|| (serialized.size() != sizeof(DeltaCacheHeader)
+			+ header.payload
+			+ (frames * sizeof(Cache(0)._durations[0])))) {
+		return {};
+	}
+
+	// Check the frame headers here, so that the lazy decoding may trust them.
+	const auto frameBytes = size * size * int(sizeof(int32));
+	const auto maskBytes = TilesMaskSize(size);
+	const auto till = int(sizeof(DeltaCacheHeader)) + header.payload;
+	auto offset = int(sizeof(DeltaCacheHeader));
+	for (auto i = 0; i != frames; ++i) {
+		if (offset + int(sizeof(DeltaFrameHeader)) > till) {
+			return {};
+		}
+		auto frame = DeltaFrameHeader();
+		memcpy(&frame, serialized.data() + offset, sizeof(frame));
+		offset += sizeof(DeltaFrameHeader);
+		const auto good = frame.keyframe
+			? (frame.original == frameBytes)
+			: (i > 0
+				&& frame.original >= maskBytes
+				&& frame.original <= maskBytes + frameBytes);
+		if (!good
+			|| frame.length <= 0
+			|| frame.length > till - offset) {
+			return {};
+		}
+		offset += frame.length;
+	}
+	if (offset != till) {
+		return {};
+	}
+
+	const auto rows = (frames + kPerRow - 1) / kPerRow;
+	const auto columns = std::min(frames, kPerRow);
+	auto durations = std::vector<uint16>(frames, 0);
+	memcpy(
+		durations.data(),
+		serialized.data() + till,
+		frames * sizeof(durations[0]));
+
+	auto result = Cache(size);
+	result._finished = true;
+	result._full = QImage(
+		columns * size,
+		rows * size,
+		QImage::Format_ARGB32_Premultiplied);
+	Assert(result._full.bytesPerLine()
+		== result._full.width() * sizeof(int32));
+	result._frames = frames;
+	result._durations = std::move(durations);
+	result.clearUnusedFrames();
+	result._serialized = serialized;
+	result._decodeOffset = sizeof(DeltaCacheHeader);
+	if (!result.decodeNext()) {
+		return {};
+	}
+	return result;
+}
+
 QByteArray Cache::serialize() {
 	Expects(_finished);
 	Expects(_durations.size() == _frames);
 	Expects(_full.bytesPerLine() == sizeof(int32) * _full.width());
 
-	auto header = CacheHeader{
-		.version = kCacheVersion,
-		.size = _size,
-		.frames = _frames,
+	ensureDecoded(_frames - 1);
+	if (_decodeFailed) {
+		return QByteArray();
+	}
+
+	auto raw = std::vector<uchar>(TilesMaskSize(_size) + frameByteSize());
+	auto compressed = std::vector<char>(
+		LZ4_compressBound(int(raw.size())));
+	auto payload = QByteArray();
+	payload.reserve(frameByteSize() * 2);
+	for (auto i = 0; i != _frames; ++i) {
+		const auto keyframe = !(i % kKeyframeInterval);
+		auto frame = DeltaFrameHeader{
+			.keyframe = keyframe ? 1 : 0,
+			.original = encodeFrame(i, keyframe, raw.data()),
+		};
+		frame.length = LZ4_compress_default(
+			reinterpret_cast<const char*>(raw.data()),
+			compressed.data(),
+			frame.original,
+			int(compressed.size()));
+		Assert(frame.length > 0);
+		payload.append(
+			reinterpret_cast<const char*>(&frame),
+			sizeof(DeltaFrameHeader));
+		payload.append(compressed.data(), frame.length);
+	}
+
+	const auto header = DeltaCacheHeader{
+		.base = {
+			.version = kDeltaCacheVersion,
+			.size = _size,
+			.frames = _frames,
+		},
+		.payload = int(payload.size()),
 	};
-	const auto input = _full.width() * _full.height() * sizeof(int32);
-	const auto max = sizeof(CacheHeader)
-		+ LZ4_compressBound(input)
-		+ (_frames * sizeof(_durations[0]));
-	auto result = QByteArray(max, Qt::Uninitialized);
-	header.length = LZ4_compress_default(
-		reinterpret_cast<const char*>(_full.constBits()),
-		result.data() + sizeof(CacheHeader),
-		input,
-		result.size() - sizeof(CacheHeader));
-	Assert(header.length > 0);
-	memcpy(result.data(), &header, sizeof(CacheHeader));
-	memcpy(
-		result.data() + sizeof(CacheHeader) + header.length,
-		_durations.data(),
-		_frames * sizeof(_durations[0]));
-	result.resize(sizeof(CacheHeader)
-		+ header.length
+	auto result = QByteArray();
+	result.reserve(sizeof(DeltaCacheHeader)
+		+ payload.size()
 		+ _frames * sizeof(_durations[0]));
-
+	result.append(
+		reinterpret_cast<const char*>(&header),
+		sizeof(DeltaCacheHeader));
+	result.append(payload);
+	result.append(
+		reinterpret_cast<const char*>(_durations.data()),
+		_frames * sizeof(_durations[0]));
 	return result;
 }
 
+int Cache::frameOffset(int index) const {
+	const auto row = index / kPerRow;
+	const auto inrow = index % kPerRow;
+	return row * _size * _full.bytesPerLine() + inrow * frameRowByteSize();
+}
+
+int Cache::encodeFrame(int index, bool keyframe, uchar *to) const {
+	const auto perLine = _full.bytesPerLine();
+	const auto rowBytes = frameRowByteSize();
+	const auto from = _full.constBits() + frameOffset(index);
+	if (keyframe) {
+		for (auto y = 0; y != _size; ++y) {
+			memcpy(to + y * rowBytes, from + y * perLine, rowBytes);
+		}
+		return frameByteSize();
+	}
+	const auto previous = _full.constBits() + frameOffset(index - 1);
+	const auto perSide = TilesPerSide(_size);
+	const auto maskBytes = TilesMaskSize(_size);
+	memset(to, 0, maskBytes);
+	auto out = to + maskBytes;
+	for (auto tile = 0; tile != perSide * perSide; ++tile) {
+		const auto left = (tile % perSide) * kTileSize;
+		const auto top = (tile / perSide) * kTileSize;
+		const auto bytes = std::min(kTileSize, _size - left) * 4;
+		const auto bottom = std::min(top + kTileSize, _size);
+		const auto shift = left * 4;
+		auto changed = false;
+		for (auto y = top; y != bottom; ++y) {
+			const auto line = y * perLine + shift;
+			if (memcmp(from + line, previous + line, bytes)) {
+				changed = true;
+				break;
+			}
+		}
+		if (!changed) {
+			continue;
+		}
+		to[tile / 8] |= uchar(1 << (tile % 8));
+		for (auto y = top; y != bottom; ++y) {
+			const auto line = y * perLine + shift;
+			XorBytes(out, from + line, previous + line, bytes);
+			out += bytes;
+		}
+	}
+	return int(out - to);
+}
+
+void Cache::ensureDecoded(int index) const {
+	while (!_serialized.isEmpty() && _decoded <= index) {
+		if (decodeNext()) {
+			continue;
+		}
+		// A broken frame may be partially applied already and all delta
+		// frames till the next keyframe are based on it, so all of them
+		// are left empty. Such cache is never serialized again.
+		_decodeFailed = true;
+		const auto perLine = _full.bytesPerLine();
+		do {
+			auto to = _full.bits() + frameOffset(_decoded);
+			for (auto y = 0; y != _size; ++y, to += perLine) {
+				memset(to, 0, frameRowByteSize());
+			}
+			skipDecoded();
+		} while (_decoded < _frames && !nextIsKeyframe());
+	}
+}
+
+bool Cache::nextIsKeyframe() const {
+	Expects(_decoded < _frames);
+
+	auto frame = DeltaFrameHeader();
+	memcpy(&frame, _serialized.constData() + _decodeOffset, sizeof(frame));
+	return (frame.keyframe != 0);
+}
+
+bool Cache::decodeNext() const {
+	Expects(_decoded < _frames);
+
+	auto frame = DeltaFrameHeader();
+	const auto data = _serialized.constData() + _decodeOffset;
+	memcpy(&frame, data, sizeof(frame));
+	if (_decodeBuffer.size() < frame.original) {
+		_decodeBuffer.resize(frame.original);
+	}
+	const auto decompressed = LZ4_decompress_safe(
+		data + sizeof(DeltaFrameHeader),
+		reinterpret_cast<char*>(_decodeBuffer.data()),
+		frame.length,
+		frame.original);
+	if (decompressed != frame.original) {
+		return false;
+	}
+
+	const auto perLine = _full.bytesPerLine();
+	const auto rowBytes = frameRowByteSize();
+	const auto bits = _full.bits();
+	const auto to = bits + frameOffset(_decoded);
+	const auto from = _decodeBuffer.data();
+	if (frame.keyframe) {
+		for (auto y = 0; y != _size; ++y) {
+			memcpy(to + y * perLine, from + y * rowBytes, rowBytes);
+		}
+		skipDecoded();
+		return true;
+	}
+	const auto previous = bits + frameOffset(_decoded - 1);
+	const auto perSide = TilesPerSide(_size);
+	const auto maskBytes = TilesMaskSize(_size);
+	auto in = from + maskBytes;
+	const auto till = from + frame.original;
+	for (auto y = 0; y != _size; ++y) {
+		memcpy(to + y * perLine, previous + y * perLine, rowBytes);
+	}
+	for (auto tile = 0; tile != perSide * perSide; ++tile) {
+		if (!(from[tile / 8] & (1 << (tile % 8)))) {
+			continue;
+		}
+		const auto left = (tile % perSide) * kTileSize;
+		const auto top = (tile / perSide) * kTileSize;
+		const auto bytes = std::min(kTileSize, _size - left) * 4;
+		const auto bottom = std::min(top + kTileSize, _size);
+		if (in + (bottom - top) * bytes > till) {
+			return false;
+		}
+		for (auto y = top; y != bottom; ++y) {
+			const auto line = to + y * perLine + left * 4;
+			XorBytes(line, line, in, bytes);
+			in += bytes;
+		}
+	}
+	if (in != till) {
+		return false;
+	}
+	skipDecoded();
+	return true;
+}
+
+void Cache::skipDecoded() const {
+	auto frame = DeltaFrameHeader();
+	memcpy(&frame, _serialized.constData() + _decodeOffset, sizeof(frame));
+	_decodeOffset += sizeof(DeltaFrameHeader) + frame.length;
+	if (++_decoded == _frames) {
+		_serialized = QByteArray();
+		_decodeBuffer = std::vector<uchar>();
+	}
+}
+
 int Cache::frames() const {
 	return _frames;
 }
@@ -261,6 +547,7 @@ Cache::Frame Cache::frame(int index) const {
 	const auto row = index / kPerRow;
 	const auto inrow = index % kPerRow;
 	if (_finished) {
+		ensureDecoded(index);
 		return { &_full, { inrow * _size, row * _size, _size, _size } };
 	}
 	return { &_images[row], { 0, inrow * _size, _size, _size } };
@@ -362,8 +649,16 @@ void Cache::finish() {
 			}
 		}
 	}
-	if (const auto perLine = zero * _size) {
-		auto dst = dstData
+	clearUnusedFrames();
+}
+
+void Cache::clearUnusedFrames() {
+	const auto rows = (_frames + kPerRow - 1) / kPerRow;
+	const auto columns = std::min(_frames, kPerRow);
+	const auto zero = (rows * columns) - _frames;
+	if (const auto perLine = zero * _size * 4) {
+		const auto dstPerLine = _full.bytesPerLine();
+		auto dst = _full.bits()
 			+ (rows - 1) * dstPerLine * _size
 			+ (columns - zero) * _size * 4;
 		for (auto left = 0; left != _size; ++left) {
@@ -459,31 +754,11 @@ Loading Cached::unload() {
 Renderer::Renderer(RendererDescriptor &&descriptor)
 : _cache(descriptor.size)
 , _put(std::move(descriptor.put))
-, _loader(std::move(descriptor.loader)) {
+, _loader(std::move(descriptor.loader))
+, _lastPaint(crl::now()) {
 	Expects(_loader != nullptr);
 
-	const auto size = _cache.size();
-	const auto guard = base::make_weak(this);
-	crl::async([=, factory = std::move(descriptor.generator)]() mutable {
-		auto generator = factory();
-		auto rendered = generator->renderNext(
-			QImage(),
-			QSize(size, size),
-			Qt::KeepAspectRatio);
-		if (rendered.image.isNull()) {
-			return;
-		}
-		crl::on_main(guard, [
-			=,
-			frame = std::move(rendered),
-			generator = std::move(generator)
-		]() mutable {
-			frameReady(
-				std::move(generator),
-				frame.duration,
-				std::move(frame.image));
-		});
-	});
+	enqueue({ .factory = std::move(descriptor.generator) });
 }
 
 Renderer::~Renderer() = default;
@@ -521,39 +796,57 @@ void Renderer::frameReady(
 void Renderer::renderNext(
 		std::unique_ptr<Ui::FrameGenerator> generator,
 		QImage storage) {
-	const auto size = _cache.size();
-	const auto guard = base::make_weak(this);
-	crl::async([
-		=,
-		storage = std::move(storage),
-		generator = std::move(generator)
-	]() mutable {
-		auto rendered = generator->renderNext(
-			std::move(storage),
-			QSize(size, size),
-			Qt::KeepAspectRatio);
-		crl::on_main(guard, [
-			=,
-			frame = std::move(rendered),
-			generator = std::move(generator)
-		]() mutable {
-			frameReady(
-				std::move(generator),
-				frame.duration,
-				std::move(frame.image));
-		});
+	enqueue({
+		.generator = std::move(generator),
+		.storage = std::move(storage),
 	});
 }
 
+void Renderer::enqueue(RenderTask &&task) {
+	const auto first = (task.generator == nullptr);
+	const auto guard = base::make_weak(this);
+	task.size = _cache.size();
+	task.priority = [=] {
+		const auto strong = guard.get();
+		return strong ? strong->priority() : RenderPriority::Dropped;
+	};
+	task.done = [=](
+			std::unique_ptr<Ui::FrameGenerator> generator,
+			Ui::FrameGenerator::Frame frame) {
+		const auto strong = guard.get();
+		if (!strong || (first && frame.image.isNull())) {
+			return;
+		}
+		strong->frameReady(
+			std::move(generator),
+			frame.duration,
+			std::move(frame.image));
+	};
+	EnqueueRender(std::move(task));
+}
+
+RenderPriority Renderer::priority() const {
+	if (crl::now() - _lastPaint > kVisibleTimeout) {
+		return RenderPriority::Hidden;
+	} else if (_cache.currentFrame() + 1 < _cache.frames()) {
+		return RenderPriority::Preload;
+	}
+	return _paused ? RenderPriority::Paused : RenderPriority::Visible;
+}
+
 void Renderer::finish() {
 	_finished = true;
 	_cache.finish();
 	if (_put) {
-		_put(_cache.serialize());
+		if (auto bytes = _cache.serialize(); !bytes.isEmpty()) {
+			_put(std::move(bytes));
+		}
 	}
 }
 
 PaintFrameResult Renderer::paint(QPainter &p, const Context &context) {
+	_lastPaint = crl::now();
+	_paused = context.paused;
 	const auto result = _cache.paintCurrentFrame(p, context);
 	if (_generator
 		&& (!result.painted
@@ -101,13 +101,33 @@ public:
 private:
 	static constexpr auto kPerRow = 16;
 
+	[[nodiscard]] static std::optional<Cache> FromSerializedDelta(
+		const QByteArray &serialized,
+		int requestedSize);
+
 	[[nodiscard]] int frameRowByteSize() const;
 	[[nodiscard]] int frameByteSize() const;
+	[[nodiscard]] int frameOffset(int index) const;
 	[[nodiscard]] crl::time currentFrameFinishes() const;
+	void clearUnusedFrames();
+
+	[[nodiscard]] int encodeFrame(int index, bool keyframe, uchar *to) const;
+	void ensureDecoded(int index) const;
+	[[nodiscard]] bool decodeNext() const;
+	[[nodiscard]] bool nextIsKeyframe() const;
+	void skipDecoded() const;
 
 	std::vector<QImage> _images;
 	std::vector<uint16> _durations;
-	QImage _full;
+
+	// Frames of a delta-compressed cache are decoded on first access.
+	mutable QImage _full;
+	mutable QByteArray _serialized;
+	mutable std::vector<uchar> _decodeBuffer;
+	mutable int _decodeOffset = 0;
+	mutable int _decoded = 0;
+	mutable bool _decodeFailed = false;
+
 	crl::time _shown = 0;
 	int _frame = 0;
 	int _size = 0;
@@ -118,6 +138,8 @@ private:
 
 class Loader;
 class Loading;
+struct RenderTask;
+enum class RenderPriority : uchar;
 
 class Cached final {
 public:
@@ -170,6 +192,8 @@ private:
 	void renderNext(
 		std::unique_ptr<Ui::FrameGenerator> generator,
 		QImage storage);
+	void enqueue(RenderTask &&task);
+	[[nodiscard]] RenderPriority priority() const;
 	void finish();
 
 	Cache _cache;
@@ -178,6 +202,8 @@ private:
 	Fn<void(QByteArray)> _put;
 	Fn<void()> _repaint;
 	Fn<std::unique_ptr<Loader>()> _loader;
+	crl::time _lastPaint = 0;
+	bool _paused = false;
 	bool _finished = false;
 
 };
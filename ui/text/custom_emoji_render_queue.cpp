@@ -0,0 +1,211 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#include "ui/text/custom_emoji_render_queue.h"
+
+#include <crl/crl_async.h>
+#include <crl/crl_on_main.h>
+
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+
+namespace Ui::CustomEmoji {
+namespace {
+
+constexpr auto kMaxRunning = 4;
+constexpr auto kLatencySmoothing = 16;
+
+struct Queued {
+	RenderTask task;
+	crl::time queued = 0;
+};
+
+struct Finished {
+	std::unique_ptr<FrameGenerator> generator;
+	FrameGenerator::Frame frame;
+	Fn<void(std::unique_ptr<FrameGenerator>, FrameGenerator::Frame)> done;
+	crl::time queued = 0;
+};
+
+class RenderQueue final {
+public:
+	RenderQueue();
+
+	void enqueue(RenderTask &&task);
+	[[nodiscard]] RenderQueueMetrics metrics() const;
+
+private:
+	[[nodiscard]] int preloadLimit() const;
+	void dispatch();
+	void start(Queued &&entry);
+
+	// Called from crl::async.
+	void finished(Finished &&result);
+
+	void flush();
+
+	const int _limit = 0;
+	std::vector<Queued> _queued;
+	int _running = 0;
+	int64 _rendered = 0;
+	int64 _dropped = 0;
+	crl::time _averageLatency = 0;
+	crl::time _maxLatency = 0;
+	bool _flushing = false;
+
+	mutable QMutex _mutex;
+	std::vector<Finished> _ready;
+
+};
+
+[[nodiscard]] RenderQueue &Queue() {
+	static const auto result = new RenderQueue();
+	return *result;
+}
+
+RenderQueue::RenderQueue()
+: _limit(std::clamp(QThread::idealThreadCount() / 2, 1, kMaxRunning)) {
+}
+
+void RenderQueue::enqueue(RenderTask &&task) {
+	Expects(task.generator || task.factory);
+	Expects(task.done != nullptr);
+
+	_queued.push_back({ std::move(task), crl::now() });
+	if (!_flushing) {
+		dispatch();
+	}
+}
+
+RenderQueueMetrics RenderQueue::metrics() const {
+	auto ready = 0;
+	{
+		QMutexLocker lock(&_mutex);
+		ready = int(_ready.size());
+	}
+	return {
+		.queued = int(_queued.size()),
+		.running = _running - ready,
+		.ready = ready,
+		.limit = _limit,
+		.rendered = _rendered,
+		.dropped = _dropped,
+		.averageLatency = _averageLatency,
+		.maxLatency = _maxLatency,
+	};
+}
+
+int RenderQueue::preloadLimit() const {
+	// Always leave one slot for the frames that are on screen right now.
+	return std::max(_limit - 1, 1);
+}
+
+void RenderQueue::dispatch() {
+	while (_running < _limit && !_queued.empty()) {
+		auto best = -1;
+		auto bestPriority = RenderPriority::Dropped;
+		for (auto i = begin(_queued); i != end(_queued);) {
+			const auto priority = i->task.priority
+				? i->task.priority()
+				: RenderPriority::Visible;
+			if (priority == RenderPriority::Dropped) {
+				// The best index is always before i, so it stays valid.
+				++_dropped;
+				i = _queued.erase(i);
+				continue;
+			} else if (priority > bestPriority) {
+				best = int(i - begin(_queued));
+				bestPriority = priority;
+			}
+			++i;
+		}
+		if (best < 0) {
+			break;
+		} else if (bestPriority < RenderPriority::Paused
+			&& _running >= preloadLimit()) {
+			break;
+		}
+		auto entry = std::move(_queued[best]);
+		_queued.erase(begin(_queued) + best);
+		start(std::move(entry));
+	}
+}
+
+void RenderQueue::start(Queued &&entry) {
+	++_running;
+	auto &task = entry.task;
+	task.priority = nullptr;
+	crl::async([
+		this,
+		factory = std::move(task.factory),
+		generator = std::move(task.generator),
+		storage = std::move(task.storage),
+		done = std::move(task.done),
+		size = task.size,
+		queued = entry.queued
+	]() mutable {
+		if (!generator) {
+			generator = factory();
+		}
+		auto frame = generator->renderNext(
+			std::move(storage),
+			QSize(size, size),
+			Qt::KeepAspectRatio);
+		finished({
+			.generator = std::move(generator),
+			.frame = std::move(frame),
+			.done = std::move(done),
+			.queued = queued,
+		});
+	});
+}
+
+void RenderQueue::finished(Finished &&result) {
+	auto schedule = false;
+	{
+		QMutexLocker lock(&_mutex);
+		schedule = _ready.empty();
+		_ready.push_back(std::move(result));
+	}
+	if (schedule) {
+		crl::on_main([=] { flush(); });
+	}
+}
+
+void RenderQueue::flush() {
+	auto ready = std::vector<Finished>();
+	{
+		QMutexLocker lock(&_mutex);
+		std::swap(ready, _ready);
+	}
+	const auto now = crl::now();
+	_running -= int(ready.size());
+	_rendered += int(ready.size());
+	_flushing = true;
+	for (auto &entry : ready) {
+		const auto latency = now - entry.queued;
+		_maxLatency = std::max(_maxLatency, latency);
+		_averageLatency = _averageLatency
+			? ((_averageLatency * (kLatencySmoothing - 1) + latency)
+				/ kLatencySmoothing)
+			: latency;
+		entry.done(std::move(entry.generator), std::move(entry.frame));
+	}
+	_flushing = false;
+	dispatch();
+}
+
+} // namespace
+
+void EnqueueRender(RenderTask &&task) {
+	Queue().enqueue(std::move(task));
+}
+
+RenderQueueMetrics RenderQueueStats() {
+	return Queue().metrics();
+}
+
+} // namespace Ui::CustomEmoji
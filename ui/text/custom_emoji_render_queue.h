@@ -0,0 +1,53 @@
+// This file is part of Desktop App Toolkit,
+// a set of libraries for developing nice desktop applications.
+//
+// For license and copyright information please follow this link:
+// https://github.com/desktop-app/legal/blob/master/LEGAL
+//
+#pragma once
+
+#include "ui/effects/frame_generator.h"
+
+namespace Ui::CustomEmoji {
+
+enum class RenderPriority : uchar {
+	Dropped,
+	Hidden,
+	Preload,
+	Paused,
+	Visible,
+};
+
+struct RenderTask {
+	// Used for the first frame, when there is no generator yet.
+	Fn<std::unique_ptr<FrameGenerator>()> factory;
+	std::unique_ptr<FrameGenerator> generator;
+	QImage storage;
+	int size = 0;
+
+	// Called on the main thread when choosing the next task to run.
+	// Returning RenderPriority::Dropped discards the task.
+	Fn<RenderPriority()> priority;
+
+	// Called on the main thread with the rendered frame.
+	Fn<void(std::unique_ptr<FrameGenerator>, FrameGenerator::Frame)> done;
+};
+
+struct RenderQueueMetrics {
+	int queued = 0;
+	int running = 0;
+	int ready = 0;
+	int limit = 0;
+	int64 rendered = 0;
+	int64 dropped = 0;
+	crl::time averageLatency = 0;
+	crl::time maxLatency = 0;
+};
+
+// All custom emoji frames are rendered through one queue, that runs at most
+// RenderQueueMetrics::limit generators at once and hands the results back
+// to the main thread in batches, one crl::on_main for all of them.
+void EnqueueRender(RenderTask &&task);
+[[nodiscard]] RenderQueueMetrics RenderQueueStats();
+
+} // namespace Ui::CustomEmoji
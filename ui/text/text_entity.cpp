@@ -1215,6 +1215,95 @@ inline QChar RemoveOneAccent(uint32 code) {
 	return QChar(0);
 }
 
+constexpr auto kAccentRemoved = ushort(0xFFFF);
+
+// RemoveOneAccent() and IsDiacritic() baked for the whole BMP.
+// Lookup gives zero to keep the char, kAccentRemoved to drop it
+// or the char to put instead.
+class AccentTable final {
+public:
+	AccentTable();
+
+	[[nodiscard]] ushort lookup(ushort code) const {
+		return _pages[_index[code >> 8]][code & 0xFF];
+	}
+
+private:
+	using Page = std::array<ushort, 256>;
+
+	std::array<uchar, 256> _index = { { 0 } };
+	std::vector<Page> _pages;
+
+};
+
+AccentTable::AccentTable() {
+	// The first page stays empty, shared by all pages without changes.
+	_pages.emplace_back();
+	_pages.back().fill(0);
+	for (auto page = 0; page != 256; ++page) {
+		auto filled = Page();
+		auto any = false;
+		for (auto i = 0; i != 256; ++i) {
+			const auto code = ushort((page << 8) | i);
+			const auto ch = QChar(code);
+			auto &value = filled[i];
+			if (code < 128 || ch.isSurrogate()) {
+				value = 0;
+			} else if (IsDiacritic(ch)) {
+				value = kAccentRemoved;
+			} else if (const auto replaced = RemoveOneAccent(code)
+				; replaced.unicode() > 0 && replaced != ch) {
+				value = replaced.unicode();
+			} else {
+				value = 0;
+			}
+			any = any || (value != 0);
+		}
+		if (any) {
+			_index[page] = uchar(_pages.size());
+			_pages.push_back(filled);
+		}
+	}
+	Ensures(_pages.size() <= 256);
+}
+
+[[nodiscard]] const AccentTable &Accents() {
+	static const auto result = AccentTable();
+	return result;
+}
+
+// First char at or above 128, eight chars at a time.
+[[nodiscard]] const QChar *SkipAscii(const QChar *ch, const QChar *end) {
+	constexpr auto kHighBits = 0xFF80FF80FF80FF80ULL;
+	for (; end - ch >= 8; ch += 8) {
+		uint64 first = 0, second = 0;
+		memcpy(&first, ch, sizeof(first));
+		memcpy(&second, ch + 4, sizeof(second));
+		if ((first | second) & kHighBits) {
+			break;
+		}
+	}
+	while (ch != end && ch->unicode() < 128) {
+		++ch;
+	}
+	return ch;
+}
+
+// Matches the RegExpWordSplit() character class without the regular
+// expression. There \s has no Unicode properties and is ASCII only,
+// so non-ASCII chars are never separators here as well.
+[[nodiscard]] bool IsSearchWordSeparator(QChar ch) {
+	static const auto Ascii = [] {
+		auto result = std::array<bool, 128>();
+		for (const auto ch : "@-+()[]{}<>,.:!_;\"' \t\n\v\f\r") {
+			result[uchar(ch)] = true; // Including the terminating zero.
+		}
+		return result;
+	}();
+	const auto code = ch.unicode();
+	return (code < 128) && Ascii[code];
+}
+
 const QRegularExpression &RegExpWordSplit() {
 	static const auto result = QRegularExpression(QString::fromLatin1("[\\@\\s\\-\\+\\(\\)\\[\\]\\{\\}\\<\\>\\,\\.\\:\\!\\_\\;\\\"\\'\\x0]"));
 	return result;
@@ -1430,6 +1519,21 @@ QString SingleLine(const QString &text) {
 	return result;
 }
 
+void SingleLine(QStringView text, QString &result) {
+	auto s = text.data(), e = text.data() + text.size();
+	while (s < e && IsTrimmed(*s)) {
+		++s;
+	}
+	while (s < e && IsTrimmed(*(e - 1))) {
+		--e;
+	}
+	result.resize(int(e - s));
+	auto to = result.data();
+	for (auto ch = s; ch != e; ++ch) {
+		*to++ = IsNewline(*ch) ? QChar(QChar::Space) : *ch;
+	}
+}
+
 TextWithEntities SingleLine(const TextWithEntities &text) {
 	auto copy = text;
 	Trim(copy);
@@ -1437,39 +1541,45 @@ TextWithEntities SingleLine(const TextWithEntities &text) {
 }
 
 QString RemoveAccents(const QString &text) {
-	auto result = text;
-	auto copying = false;
-	auto i = 0;
-	for (auto s = text.unicode(), ch = s, e = text.unicode() + text.size(); ch != e; ++ch, ++i) {
-		if (ch->unicode() < 128) {
-			if (copying) result[i] = *ch;
-			continue;
+	const auto begin = text.unicode();
+	if (SkipAscii(begin, begin + text.size()) == begin + text.size()) {
+		return text;
+	}
+	auto result = QString();
+	RemoveAccents(text, result);
+	return result;
+}
+
+void RemoveAccents(QStringView text, QString &result) {
+	const auto &table = Accents();
+	const auto end = text.data() + text.size();
+	result.resize(int(text.size()));
+	auto to = result.data();
+	for (auto from = text.data(); from != end;) {
+		const auto ascii = SkipAscii(from, end);
+		if (ascii != from) {
+			memcpy(to, from, (ascii - from) * sizeof(QChar));
+			to += (ascii - from);
+			from = ascii;
+			if (from == end) {
+				break;
+			}
 		}
-		if (IsDiacritic(*ch)) {
-			copying = true;
-			--i;
+		if (from->isHighSurrogate()
+			&& from + 1 != end
+			&& (from + 1)->isLowSurrogate()) {
+			// No accents are folded outside of the BMP.
+			*to++ = *from++;
+			*to++ = *from++;
 			continue;
 		}
-		if (ch->isHighSurrogate() && ch + 1 < e && (ch + 1)->isLowSurrogate()) {
-			auto noAccent = RemoveOneAccent(QChar::surrogateToUcs4(*ch, *(ch + 1)));
-			if (noAccent.unicode() > 0) {
-				copying = true;
-				result[i] = noAccent;
-			} else {
-				if (copying) result[i] = *ch;
-				++ch, ++i;
-				if (copying) result[i] = *ch;
-			}
-		} else {
-			auto noAccent = RemoveOneAccent(ch->unicode());
-			if (noAccent.unicode() > 0 && noAccent != *ch) {
-				result[i] = noAccent;
-			} else if (copying) {
-				result[i] = *ch;
-			}
+		const auto mapped = table.lookup(from->unicode());
+		if (mapped != kAccentRemoved) {
+			*to++ = mapped ? QChar(mapped) : *from;
 		}
+		++from;
 	}
-	return (i < result.size()) ? result.mid(0, i) : result;
+	result.resize(int(to - result.data()));
 }
 
 QString RemoveEmoji(const QString &text) {
@@ -1479,6 +1589,16 @@ QString RemoveEmoji(const QString &text) {
 	auto begin = text.data();
 	const auto end = begin + text.size();
 	while (begin != end) {
+		// Only the last char of an ASCII run may start an emoji (keycaps).
+		const auto ascii = SkipAscii(begin, end);
+		const auto safe = (ascii == end) ? end : (ascii - 1);
+		if (safe > begin) {
+			result.append(begin, int(safe - begin));
+			begin = safe;
+			if (begin == end) {
+				break;
+			}
+		}
 		auto length = 0;
 		if (Ui::Emoji::Find(begin, end, &length)) {
 			begin += length;
@@ -1498,19 +1618,149 @@ QStringList PrepareSearchWords(
 		const QRegularExpression *SplitterOverride) {
 	auto clean = RemoveAccents(query.trimmed().toLower());
 	auto result = QStringList();
-	if (!clean.isEmpty()) {
-		auto list = clean.split(SplitterOverride
-			? *SplitterOverride
-			: RegExpWordSplit(),
-			Qt::SkipEmptyParts);
-		result.reserve(list.size());
-		for (const auto &word : std::as_const(list)) {
-			auto trimmed = word.trimmed();
-			if (!trimmed.isEmpty()) {
-				result.push_back(trimmed);
+	if (clean.isEmpty()) {
+		return result;
+	} else if (!SplitterOverride) {
+		const auto till = clean.size();
+		for (auto i = qsizetype(); i != till;) {
+			while (i != till && IsSearchWordSeparator(clean[i])) {
+				++i;
+			}
+			const auto from = i;
+			while (i != till && !IsSearchWordSeparator(clean[i])) {
+				++i;
+			}
+			if (i != from) {
+				auto trimmed = clean.mid(from, i - from).trimmed();
+				if (!trimmed.isEmpty()) {
+					result.push_back(std::move(trimmed));
+				}
 			}
 		}
+		return result;
+	}
+	auto list = clean.split(*SplitterOverride, Qt::SkipEmptyParts);
+	result.reserve(list.size());
+	for (const auto &word : std::as_const(list)) {
+		auto trimmed = word.trimmed();
+		if (!trimmed.isEmpty()) {
+			result.push_back(trimmed);
+		}
+	}
+	return result;
+}
+
+void SearchIndex::add(uint64 id, const QString &text) {
+	auto &item = _items[id];
+	_stale += int(item.words.size());
+	item.words = PrepareSearchWords(text);
+	item.words.removeDuplicates();
+	item.generation = ++_generation;
+	for (const auto &word : std::as_const(item.words)) {
+		_words.push_back({ word, id, item.generation });
+	}
+	if (_stale > int(_words.size()) / 2) {
+		compact();
+	}
+}
+
+void SearchIndex::remove(uint64 id) {
+	const auto i = _items.find(id);
+	if (i == end(_items)) {
+		return;
+	}
+	_stale += int(i->second.words.size());
+	_items.erase(i);
+	if (_stale > int(_words.size()) / 2) {
+		compact();
+	}
+}
+
+void SearchIndex::clear() {
+	_words.clear();
+	_items.clear();
+	_sorted = 0;
+	_stale = 0;
+}
+
+int SearchIndex::size() const {
+	return int(_items.size());
+}
+
+void SearchIndex::sort() const {
+	if (_sorted == int(_words.size())) {
+		return;
+	}
+	const auto less = [](const Word &a, const Word &b) {
+		return (a.text < b.text) || (a.text == b.text && a.id < b.id);
+	};
+	const auto middle = begin(_words) + _sorted;
+	std::sort(middle, end(_words), less);
+	std::inplace_merge(begin(_words), middle, end(_words), less);
+	_sorted = int(_words.size());
+}
+
+void SearchIndex::compact() {
+	// Removing keeps the order, the sorted part only gets shorter.
+	auto kept = 0;
+	auto sorted = 0;
+	for (auto i = 0, count = int(_words.size()); i != count; ++i) {
+		const auto &word = _words[i];
+		const auto j = _items.find(word.id);
+		if (j == end(_items) || j->second.generation != word.generation) {
+			continue;
+		} else if (i < _sorted) {
+			++sorted;
+		}
+		if (kept != i) {
+			_words[kept] = std::move(_words[i]);
+		}
+		++kept;
+	}
+	_words.resize(kept);
+	_sorted = sorted;
+	_stale = 0;
+}
+
+std::vector<uint64> SearchIndex::find(const QString &query) const {
+	auto words = PrepareSearchWords(query);
+	if (words.isEmpty()) {
+		return {};
+	}
+	sort();
+
+	// Start with the longest word, it has the least matches.
+	const auto longest = ranges::max_element(words, std::less<>(), [](
+			const QString &word) {
+		return word.size();
+	});
+	const auto first = *longest;
+	words.erase(longest);
+
+	auto result = std::vector<uint64>();
+	auto from = std::lower_bound(
+		begin(_words),
+		end(_words),
+		first,
+		[](const Word &word, const QString &text) {
+			return word.text < text;
+		});
+	for (; from != end(_words) && from->text.startsWith(first); ++from) {
+		const auto i = _items.find(from->id);
+		if (i == end(_items) || i->second.generation != from->generation) {
+			continue;
+		}
+		const auto matches = ranges::all_of(words, [&](const QString &query) {
+			return ranges::any_of(i->second.words, [&](const QString &word) {
+				return word.startsWith(query);
+			});
+		});
+		if (matches) {
+			result.push_back(from->id);
+		}
 	}
+	ranges::sort(result);
+	result.erase(ranges::unique(result), end(result));
 	return result;
 }
 
@@ -10,6 +10,7 @@
 #include "base/basic_types.h"
 #include "base/algorithm.h"
 #include "base/flags.h"
+#include "base/flat_map.h"
 
 #include <QtCore/QList>
 #include <QtCore/QVector>
@@ -382,11 +383,51 @@ QString EscapeForRichParsing(const QString &text);
 QString SingleLine(const QString &text);
 TextWithEntities SingleLine(const TextWithEntities &text);
 QString RemoveAccents(const QString &text);
+
+// Write the result to a buffer, reusing its capacity.
+// The text must not point inside the buffer.
+void SingleLine(QStringView text, QString &result);
+void RemoveAccents(QStringView text, QString &result);
+
 QString RemoveEmoji(const QString &text);
 QString NameSortKey(const QString &text);
 QStringList PrepareSearchWords(const QString &query, const QRegularExpression *SplitterOverride = nullptr);
 bool CutPart(TextWithEntities &sending, TextWithEntities &left, int limit);
 
+// Words of many items, sorted for prefix queries.
+// add() with an existing id replaces its text, find() returns the ids
+// of the items having a word starting with each of the query words.
+class SearchIndex final {
+public:
+	void add(uint64 id, const QString &text);
+	void remove(uint64 id);
+	void clear();
+
+	[[nodiscard]] std::vector<uint64> find(const QString &query) const;
+	[[nodiscard]] int size() const;
+
+private:
+	struct Word {
+		QString text;
+		uint64 id = 0;
+		uint32 generation = 0;
+	};
+	struct Item {
+		QStringList words;
+		uint32 generation = 0;
+	};
+
+	void sort() const;
+	void compact();
+
+	mutable std::vector<Word> _words;
+	mutable int _sorted = 0;
+	base::flat_map<uint64, Item> _items;
+	uint32 _generation = 0;
+	int _stale = 0;
+
+};
+
 struct MentionNameFields {
 	uint64 selfId = 0;
 	uint64 userId = 0;
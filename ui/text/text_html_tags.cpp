@@ -2165,16 +2165,15 @@ void ParseStyleRules(QStringView css, not_null<StyleClasses*> classes) {
 	}
 }
 
-[[nodiscard]] StyleClasses ParseStyleClasses(QStringView html) {
-	auto result = StyleClasses();
+void ParseStyleClasses(QStringView html, not_null<StyleClasses*> classes) {
 	for (auto i = 0;;) {
 		const auto open = FindTagStart(html, u"<style"_q, i);
 		if (open < 0) {
-			return result;
+			return;
 		}
 		const auto contentFrom = FindTagEnd(html, open + 6);
 		if (contentFrom < 0) {
-			return result;
+			return;
 		}
 		const auto close = html.indexOf(
 			u"</style"_q,
@@ -2183,14 +2182,20 @@ void ParseStyleRules(QStringView css, not_null<StyleClasses*> classes) {
 		const auto contentTill = (close < 0) ? int(html.size()) : close;
 		ParseStyleRules(
 			html.mid(contentFrom + 1, contentTill - contentFrom - 1),
-			&result);
+			classes);
 		if (close < 0) {
-			return result;
+			return;
 		}
 		i = close + 7;
 	}
 }
 
+[[nodiscard]] StyleClasses ParseStyleClasses(QStringView html) {
+	auto result = StyleClasses();
+	ParseStyleClasses(html, &result);
+	return result;
+}
+
 [[nodiscard]] TableScanResult ScanTable(
 		QStringView html,
 		int from,
@@ -2518,6 +2523,7 @@ struct BlockParseState {
 	int preDepth = 0;
 	int blockCount = 0;
 	int totalLength = 0;
+	int sourceOffset = 0; // Of the parsed html in the whole document.
 	bool inSummary = false;
 	bool inCaption = false;
 	bool truncated = false;
@@ -3544,6 +3550,240 @@ void ProcessBlockTag(
 	ProcessTag(content, name, attributes, closing, selfClosing);
 }
 
+template <std::size_t Size>
+[[nodiscard]] bool ViewIsOneOf(
+		QStringView name,
+		const std::array<QString, Size> &names) {
+	for (const auto &entry : names) {
+		if (!name.compare(entry, Qt::CaseInsensitive)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void AddHtmlTagFeatures(
+		HtmlFeatures &result,
+		QStringView name,
+		QStringView attributes) {
+	static const auto kFormatting = std::array{
+		u"b"_q,
+		u"strong"_q,
+		u"i"_q,
+		u"em"_q,
+		u"u"_q,
+		u"s"_q,
+		u"strike"_q,
+		u"del"_q,
+		u"tg-spoiler"_q,
+		u"sub"_q,
+		u"sup"_q,
+		u"mark"_q,
+		u"code"_q,
+		u"pre"_q,
+		u"blockquote"_q,
+	};
+	static const auto kLists = std::array{
+		u"ul"_q,
+		u"ol"_q,
+		u"li"_q,
+	};
+	static const auto kMedia = std::array{
+		u"img"_q,
+		u"video"_q,
+		u"audio"_q,
+		u"picture"_q,
+	};
+	static const auto kBlocks = std::array{
+		u"p"_q,
+		u"h1"_q,
+		u"h2"_q,
+		u"h3"_q,
+		u"h4"_q,
+		u"h5"_q,
+		u"h6"_q,
+		u"li"_q,
+		u"pre"_q,
+		u"blockquote"_q,
+		u"hr"_q,
+		u"img"_q,
+		u"video"_q,
+		u"audio"_q,
+		u"table"_q,
+		u"figure"_q,
+		u"details"_q,
+	};
+	if (ViewIsOneOf(name, kFormatting)) {
+		result.formatting = true;
+	} else if (!name.compare(u"a"_q, Qt::CaseInsensitive)) {
+		result.links = true;
+	} else if (!name.compare(u"style"_q, Qt::CaseInsensitive)) {
+		result.styles = true;
+	} else if (!name.compare(u"table"_q, Qt::CaseInsensitive)) {
+		result.tables = true;
+	} else if (!name.compare(u"tr"_q, Qt::CaseInsensitive)) {
+		++result.rows;
+	} else if (!name.compare(u"td"_q, Qt::CaseInsensitive)
+		|| !name.compare(u"th"_q, Qt::CaseInsensitive)) {
+		++result.cells;
+	} else if (!name.compare(u"tg-emoji"_q, Qt::CaseInsensitive)) {
+		result.customEmoji = true;
+	}
+	if (ViewIsOneOf(name, kLists)) {
+		result.lists = true;
+	}
+	if (ViewIsOneOf(name, kMedia)) {
+		result.media = true;
+	}
+	if (ViewIsOneOf(name, kBlocks)) {
+		++result.blocks;
+	}
+	if (attributes.isEmpty()) {
+		return;
+	} else if (attributes.contains(u"style"_q, Qt::CaseInsensitive)
+		|| attributes.contains(u"class"_q, Qt::CaseInsensitive)) {
+		result.styles = true;
+	}
+	if (attributes.contains(u"data-tg-"_q, Qt::CaseInsensitive)
+		|| attributes.contains(u"data-entity-type"_q, Qt::CaseInsensitive)) {
+		result.customEmoji = true;
+	}
+}
+
+void ParseBlocks(
+		BlockParseState &state,
+		QStringView html,
+		const StyleClasses &classes) {
+	ScanHtml(html, [&](int from, int till) {
+		if (state.content.hidden.empty()) {
+			AppendText(state.content, html.mid(from, till - from));
+		}
+	}, [&](
+			const QString &name,
+			int tagFrom,
+			int nameEnd,
+			int tagEnd,
+			bool closing,
+			bool selfClosing) {
+		auto attributes = std::vector<HtmlAttribute>();
+		if (!closing) {
+			attributes = ReadAttributes(
+				html,
+				nameEnd,
+				tagEnd,
+				state.content.entityCache);
+		}
+		if (!closing
+			&& !selfClosing
+			&& (name == u"table"_q)
+			&& state.content.hidden.empty()
+			&& (state.preDepth == 0)
+			&& !IsHiddenByAttributes(attributes)) {
+			const auto scanned = ScanTable(
+				html,
+				tagFrom,
+				state.limits->table,
+				classes);
+			if (auto table = TableFromScan(
+					html,
+					scanned,
+					state.limits->table,
+					classes)) {
+				table->sourceFrom = state.sourceOffset + tagFrom;
+				table->sourceTill += state.sourceOffset;
+				AppendTableBlock(
+					state,
+					std::move(*table),
+					AnchorIdFromAttributes(attributes));
+				return scanned.sourceTill;
+			}
+		}
+		ProcessBlockTag(state, name, attributes, closing, selfClosing);
+		return -1;
+	});
+}
+
+void FinishBlocks(BlockParseState &state) {
+	while (!state.stack.empty()) {
+		PopBlockContainer(state);
+	}
+	FlushLeafBlock(state);
+}
+
+[[nodiscard]] int FindClosingTag(
+		QStringView html,
+		const QString &name,
+		int from) {
+	const auto open = u"<"_q + name;
+	const auto close = u"</"_q + name;
+	for (auto depth = 1;;) {
+		const auto nextClose = FindTagStart(html, close, from);
+		if (nextClose < 0) {
+			return -1;
+		}
+		const auto nextOpen = FindTagStart(html, open, from);
+		if (nextOpen >= 0 && nextOpen < nextClose) {
+			++depth;
+			from = nextOpen + int(open.size());
+		} else if (!--depth) {
+			return nextClose;
+		} else {
+			from = nextClose + int(close.size());
+		}
+	}
+}
+
+// Length of the prefix that ScanHtml() can process without the rest:
+// it ends before a '<' and has no unfinished tags, comments, tables
+// or style sheets, those are scanned till their end in one go.
+[[nodiscard]] int CompleteHtmlPrefix(QStringView html) {
+	const auto size = int(html.size());
+	for (auto i = 0; i != size;) {
+		const auto tagFrom = html.indexOf(QChar('<'), i);
+		if (tagFrom < 0) {
+			return i;
+		} else if (tagFrom + 1 == size) {
+			return tagFrom;
+		} else if (HasSequence(html, tagFrom, u"<!--"_q)) {
+			const auto end = FindSequence(html, tagFrom + 4, u"-->"_q);
+			if (end < 0) {
+				return tagFrom;
+			}
+			i = end + 3;
+			continue;
+		} else if (html[tagFrom + 1] == '!' || html[tagFrom + 1] == '?') {
+			const auto end = FindTagEnd(html, tagFrom + 2);
+			if (end < 0) {
+				return tagFrom;
+			}
+			i = end + 1;
+			continue;
+		} else if (tagFrom + 4 > size) {
+			// Maybe the beginning of a comment.
+			return tagFrom;
+		}
+		const auto closing = (html[tagFrom + 1] == '/');
+		const auto tagStart = tagFrom + (closing ? 2 : 1);
+		const auto tagEnd = FindTagEnd(html, tagStart);
+		if (tagEnd < 0) {
+			return tagFrom;
+		}
+		i = tagEnd + 1;
+		if (!closing) {
+			auto nameEnd = tagStart;
+			const auto name = ReadTagName(html, tagStart, tagEnd, &nameEnd);
+			if (name == u"table"_q || name == u"style"_q) {
+				const auto close = FindClosingTag(html, name, i);
+				if (close < 0) {
+					return tagFrom;
+				}
+				i = close;
+			}
+		}
+	}
+	return size;
+}
+
 } // namespace
 
 QString EscapeForHtml(QStringView text) {
@@ -3669,6 +3909,70 @@ bool HtmlContainsTable(QStringView html) {
 	return (FindTagStart(html, u"<table"_q, 0) >= 0);
 }
 
+HtmlFeatures ScanHtmlFeatures(
+		QStringView html,
+		const HtmlBlocksLimits &limits) {
+	auto result = HtmlFeatures();
+
+	// Same tokenization as ScanHtml(), but tag names and attributes
+	// are only looked at in place, nothing is decoded or allocated.
+	const auto size = int(html.size());
+	for (auto i = 0; i != size;) {
+		const auto nextTag = html.indexOf(QChar('<'), i);
+		if (nextTag < 0) {
+			result.textLength += size - i;
+			break;
+		}
+		result.textLength += nextTag - i;
+		i = nextTag;
+		if (HasSequence(html, i, u"<!--"_q)) {
+			const auto end = FindSequence(html, i + 4, u"-->"_q);
+			i = (end < 0) ? size : end + 3;
+			continue;
+		} else if (i + 2 <= size
+			&& (html[i + 1] == '!' || html[i + 1] == '?')) {
+			const auto end = FindTagEnd(html, i + 2);
+			i = (end < 0) ? size : end + 1;
+			continue;
+		}
+		auto tagStart = i + 1;
+		const auto closing = (tagStart != size) && (html[tagStart] == '/');
+		if (closing) {
+			++tagStart;
+		}
+		const auto tagEnd = FindTagEnd(html, tagStart);
+		if (tagEnd < 0) {
+			result.textLength += size - i;
+			break;
+		}
+		auto nameEnd = tagStart;
+		while (nameEnd != tagEnd && html[nameEnd].isSpace()) {
+			++nameEnd;
+		}
+		const auto nameStart = nameEnd;
+		if (nameEnd == tagEnd || !IsTagNameStartChar(html[nameEnd])) {
+			++result.textLength;
+			++i;
+			continue;
+		}
+		while (nameEnd != tagEnd && IsTagNameChar(html[nameEnd])) {
+			++nameEnd;
+		}
+		if (!closing) {
+			AddHtmlTagFeatures(
+				result,
+				html.mid(nameStart, nameEnd - nameStart),
+				html.mid(nameEnd, tagEnd - nameEnd));
+		}
+		i = tagEnd + 1;
+	}
+	result.exceedsLimits = (result.textLength > limits.maxTotalLength)
+		|| (result.blocks > limits.maxBlocks)
+		|| (result.rows > limits.table.maxRows)
+		|| (result.cells > limits.table.maxCells);
+	return result;
+}
+
 std::optional<HtmlTable> TableFromHtml(
 		QStringView html,
 		const HtmlTableLimits &limits) {
@@ -3703,56 +4007,8 @@ std::optional<HtmlBlocks> BlocksFromHtml(
 	state.limits = &limits;
 	state.content.classes = &classes;
 	state.content.richFormatting = true;
-	ScanHtml(html, [&](int from, int till) {
-		if (state.content.hidden.empty()) {
-			AppendText(state.content, html.mid(from, till - from));
-		}
-	}, [&](
-			const QString &name,
-			int tagFrom,
-			int nameEnd,
-			int tagEnd,
-			bool closing,
-			bool selfClosing) {
-		auto attributes = std::vector<HtmlAttribute>();
-		if (!closing) {
-			attributes = ReadAttributes(
-				html,
-				nameEnd,
-				tagEnd,
-				state.content.entityCache);
-		}
-		if (!closing
-			&& !selfClosing
-			&& (name == u"table"_q)
-			&& state.content.hidden.empty()
-			&& (state.preDepth == 0)
-			&& !IsHiddenByAttributes(attributes)) {
-			const auto scanned = ScanTable(
-				html,
-				tagFrom,
-				limits.table,
-				classes);
-			if (auto table = TableFromScan(
-					html,
-					scanned,
-					limits.table,
-					classes)) {
-				table->sourceFrom = tagFrom;
-				AppendTableBlock(
-					state,
-					std::move(*table),
-					AnchorIdFromAttributes(attributes));
-				return scanned.sourceTill;
-			}
-		}
-		ProcessBlockTag(state, name, attributes, closing, selfClosing);
-		return -1;
-	});
-	while (!state.stack.empty()) {
-		PopBlockContainer(state);
-	}
-	FlushLeafBlock(state);
+	ParseBlocks(state, html, classes);
+	FinishBlocks(state);
 	const auto plainSingle = (state.blocks.size() == 1)
 		&& (state.blocks.front().kind == HtmlBlockKind::Paragraph)
 		&& !HasInlineMathTag(state.blocks.front().text.tags);
@@ -3765,4 +4021,103 @@ std::optional<HtmlBlocks> BlocksFromHtml(
 	};
 }
 
+struct HtmlBlocksStream::State {
+	BlockParseState parse;
+	HtmlBlocksLimits limits;
+	StyleClasses classes;
+	QString pending;
+	bool finished = false;
+};
+
+HtmlBlocksStream::HtmlBlocksStream(
+	HtmlBlocksLimits limits,
+	Fn<void(HtmlBlock&&)> callback)
+: _state(std::make_unique<State>())
+, _callback(std::move(callback)) {
+	Expects(_callback != nullptr);
+
+	_state->limits = limits;
+	_state->parse.limits = &_state->limits;
+	_state->parse.content.classes = &_state->classes;
+	_state->parse.content.richFormatting = true;
+	if ((limits.maxBlocks <= 0)
+		|| (limits.maxBlockLength <= 0)
+		|| (limits.maxTotalLength <= 0)) {
+		_state->finished = true;
+	}
+}
+
+HtmlBlocksStream::~HtmlBlocksStream() = default;
+
+void HtmlBlocksStream::feed(QStringView chunk) {
+	constexpr auto kMaxPending = 4 * 1024 * 1024;
+
+	auto &state = *_state;
+	if (state.finished || full()) {
+		return;
+	}
+	state.pending.append(chunk);
+	const auto till = CompleteHtmlPrefix(state.pending);
+	if (till > 0) {
+		process(QStringView(state.pending).mid(0, till));
+		state.pending.remove(0, till);
+	}
+	if (state.pending.size() > kMaxPending) {
+		// Some tag, table or comment is never closed, give up on it.
+		state.parse.truncated = true;
+		state.pending = QString();
+		state.finished = true;
+	}
+	flush(false);
+}
+
+void HtmlBlocksStream::finish() {
+	auto &state = *_state;
+	if (!state.finished) {
+		state.finished = true;
+		if (!state.pending.isEmpty()) {
+			process(state.pending);
+			state.pending = QString();
+		}
+		FinishBlocks(state.parse);
+	}
+	flush(true);
+}
+
+bool HtmlBlocksStream::truncated() const {
+	return _state->parse.truncated;
+}
+
+bool HtmlBlocksStream::full() const {
+	const auto &state = _state->parse;
+	return (state.blockCount >= _state->limits.maxBlocks)
+		|| (state.totalLength >= _state->limits.maxTotalLength);
+}
+
+void HtmlBlocksStream::process(QStringView html) {
+	ParseStyleClasses(html, &_state->classes);
+	ParseBlocks(_state->parse, html, _state->classes);
+	_state->parse.sourceOffset += int(html.size());
+}
+
+void HtmlBlocksStream::flush(bool all) {
+	auto &state = _state->parse;
+	if (!state.stack.empty()) {
+		return;
+	}
+
+	// The last block may still get a caption from the following tags.
+	const auto count = int(state.blocks.size()) - (all ? 0 : 1);
+	if (count <= 0) {
+		return;
+	}
+	auto ready = std::vector<HtmlBlock>(
+		std::make_move_iterator(begin(state.blocks)),
+		std::make_move_iterator(begin(state.blocks) + count));
+	state.blocks.erase(begin(state.blocks), begin(state.blocks) + count);
+	for (auto &block : ready) {
+		_callback(std::move(block));
+	}
+}
+
 } // namespace TextUtilities
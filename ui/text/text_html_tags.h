@@ -8,6 +8,7 @@
 
 #include "ui/text/text_entity.h"
 
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -138,6 +139,28 @@ struct HtmlBlocks {
 	bool truncated = false;
 };
 
+// Result of a quick pass over HTML, without building anything.
+// Any feature the parsers would react to is reported, but some of the
+// reported ones may turn out to be ignored by them.
+struct HtmlFeatures {
+	int textLength = 0;
+	int blocks = 0;
+	int rows = 0;
+	int cells = 0;
+	bool formatting = false;
+	bool links = false;
+	bool styles = false;
+	bool lists = false;
+	bool tables = false;
+	bool media = false;
+	bool customEmoji = false;
+	bool exceedsLimits = false;
+
+	[[nodiscard]] bool mayHaveTags() const {
+		return formatting || links || styles || customEmoji;
+	}
+};
+
 [[nodiscard]] QString EscapeForHtml(QStringView text);
 [[nodiscard]] QString TextWithTagsToHtml(const TextWithTags &text);
 [[nodiscard]] QString TextForMimeDataToHtml(const TextForMimeData &text);
@@ -146,6 +169,9 @@ struct HtmlBlocks {
 	bool richFormatting = false);
 [[nodiscard]] TextWithTags TextWithTagsFromHtmlFragment(QStringView html);
 [[nodiscard]] bool HtmlContainsTable(QStringView html);
+[[nodiscard]] HtmlFeatures ScanHtmlFeatures(
+	QStringView html,
+	const HtmlBlocksLimits &limits = {});
 [[nodiscard]] std::optional<HtmlTable> TableFromHtml(
 	QStringView html,
 	const HtmlTableLimits &limits);
@@ -154,4 +180,35 @@ struct HtmlBlocks {
 	QStringView html,
 	const HtmlBlocksLimits &limits);
 
+// BlocksFromHtml() for documents that arrive in chunks.
+// Top-level blocks go to the callback as soon as they are complete,
+// only the unfinished tail of the input is kept in memory.
+// Nothing is emitted while a top-level container (a quote, a list or
+// details) is open, so a document wrapped in one is kept whole until
+// it is closed. Table source ranges are offsets in the whole document.
+// Style sheets apply to the content that follows them.
+class HtmlBlocksStream final {
+public:
+	HtmlBlocksStream(
+		HtmlBlocksLimits limits,
+		Fn<void(HtmlBlock&&)> callback);
+	~HtmlBlocksStream();
+
+	void feed(QStringView chunk);
+	void finish();
+
+	[[nodiscard]] bool truncated() const;
+
+private:
+	struct State;
+
+	[[nodiscard]] bool full() const;
+	void process(QStringView html);
+	void flush(bool all);
+
+	const std::unique_ptr<State> _state;
+	const Fn<void(HtmlBlock&&)> _callback;
+
+};
+
 } // namespace TextUtilities
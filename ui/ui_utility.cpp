@@ -9,6 +9,7 @@
 #include "base/platform/base_platform_info.h"
 #include "ui/integration.h"
 #include "ui/style/style_core.h"
+#include "base/timer.h"
 
 #include <QtWidgets/QApplication>
 #include <QtGui/QWindow>
@@ -22,6 +23,109 @@ namespace {
 
 constexpr auto kDefaultWheelScrollLines = 3;
 constexpr auto kMagicScrollMultiplier = 2.5;
+constexpr auto kSnapshotPoolCount = 4;
+constexpr auto kSnapshotPoolBytes = 16 * 1024 * 1024;
+constexpr auto kSnapshotPoolTimeout = crl::time(3000);
+
+// Show / hide animations grab the same widgets at the same sizes again and
+// again. When an animation finishes it gives its buffer back through
+// ReturnSnapshot() and the next grab of the same size takes it from here.
+// Buffers not taken again for a few seconds are freed.
+template <typename Buffer>
+class SnapshotPool final {
+public:
+	template <typename Create>
+	[[nodiscard]] Buffer take(QSize size, int ratio, Create create);
+	void put(Buffer &&buffer);
+
+private:
+	struct Entry {
+		Buffer buffer;
+		crl::time returned = 0;
+	};
+
+	[[nodiscard]] static int64 BytesOf(const Buffer &buffer);
+	void trim();
+
+	std::vector<Entry> _entries;
+	std::unique_ptr<base::Timer> _trimTimer;
+
+};
+
+template <typename Buffer>
+template <typename Create>
+Buffer SnapshotPool<Buffer>::take(QSize size, int ratio, Create create) {
+	const auto i = ranges::find_if(_entries, [&](const Entry &entry) {
+		return (entry.buffer.size() == size)
+			&& (entry.buffer.devicePixelRatio() == ratio);
+	});
+	if (i != end(_entries)) {
+		auto result = std::move(i->buffer);
+		_entries.erase(i);
+		return result;
+	}
+	auto result = create();
+	result.setDevicePixelRatio(ratio);
+	return result;
+}
+
+template <typename Buffer>
+void SnapshotPool<Buffer>::put(Buffer &&buffer) {
+	const auto bytes = BytesOf(buffer);
+	if (buffer.isNull()
+		|| !buffer.isDetached()
+		|| bytes > kSnapshotPoolBytes) {
+		// Still used somewhere else or too large to keep around.
+		return;
+	}
+	auto total = bytes;
+	for (const auto &entry : _entries) {
+		total += BytesOf(entry.buffer);
+	}
+	auto i = begin(_entries);
+	while (i != end(_entries)
+		&& (_entries.size() >= kSnapshotPoolCount
+			|| total > kSnapshotPoolBytes)) {
+		total -= BytesOf(i->buffer);
+		i = _entries.erase(i);
+	}
+	_entries.push_back({ std::move(buffer), crl::now() });
+	if (!_trimTimer) {
+		_trimTimer = std::make_unique<base::Timer>([=] { trim(); });
+	}
+	if (!_trimTimer->isActive()) {
+		_trimTimer->callOnce(kSnapshotPoolTimeout);
+	}
+}
+
+template <typename Buffer>
+void SnapshotPool<Buffer>::trim() {
+	const auto now = crl::now();
+	_entries.erase(ranges::remove_if(_entries, [&](const Entry &entry) {
+		return (entry.returned + kSnapshotPoolTimeout <= now);
+	}), end(_entries));
+	if (!_entries.empty()) {
+		const auto oldest = _entries.front().returned;
+		_trimTimer->callOnce(oldest + kSnapshotPoolTimeout - now);
+	}
+}
+
+template <typename Buffer>
+int64 SnapshotPool<Buffer>::BytesOf(const Buffer &buffer) {
+	return int64(buffer.width()) * buffer.height() * 4;
+}
+
+// Leaked, so that pixmaps and the timer are never destroyed after
+// the application during the static destruction.
+[[nodiscard]] SnapshotPool<QPixmap> &PixmapSnapshots() {
+	static const auto result = new SnapshotPool<QPixmap>();
+	return *result;
+}
+
+[[nodiscard]] SnapshotPool<QImage> &ImageSnapshots() {
+	static const auto result = new SnapshotPool<QImage>();
+	return *result;
+}
 
 class WidgetCreator : public QWidget {
 public:
@@ -118,8 +222,17 @@ QPixmap GrabWidget(not_null<QWidget*> target, QRect rect, QColor bg) {
 		rect = target->rect();
 	}
 
-	auto result = QPixmap(rect.size() * style::DevicePixelRatio());
-	result.setDevicePixelRatio(style::DevicePixelRatio());
+	const auto ratio = style::DevicePixelRatio();
+	const auto size = rect.size() * ratio;
+	if (size.isEmpty()) {
+		auto result = QPixmap(size);
+		result.setDevicePixelRatio(ratio);
+		return result;
+	}
+	auto &pool = PixmapSnapshots();
+	auto result = pool.take(size, ratio, [&] {
+		return QPixmap(size);
+	});
 	if (!target->testAttribute(Qt::WA_OpaquePaintEvent)) {
 		result.fill(bg);
 	}
@@ -136,10 +249,17 @@ QImage GrabWidgetToImage(not_null<QWidget*> target, QRect rect, QColor bg) {
 		rect = target->rect();
 	}
 
-	auto result = QImage(
-		rect.size() * style::DevicePixelRatio(),
-		QImage::Format_ARGB32_Premultiplied);
-	result.setDevicePixelRatio(style::DevicePixelRatio());
+	const auto ratio = style::DevicePixelRatio();
+	const auto size = rect.size() * ratio;
+	if (size.isEmpty()) {
+		auto result = QImage(size, QImage::Format_ARGB32_Premultiplied);
+		result.setDevicePixelRatio(ratio);
+		return result;
+	}
+	auto &pool = ImageSnapshots();
+	auto result = pool.take(size, ratio, [&] {
+		return QImage(size, QImage::Format_ARGB32_Premultiplied);
+	});
 	if (!target->testAttribute(Qt::WA_OpaquePaintEvent)) {
 		result.fill(bg);
 	}
@@ -150,6 +270,27 @@ QImage GrabWidgetToImage(not_null<QWidget*> target, QRect rect, QColor bg) {
 	return result;
 }
 
+QImage TakeSnapshotImage(QSize size) {
+	const auto ratio = style::DevicePixelRatio();
+	const auto pixels = size * ratio;
+	if (pixels.isEmpty()) {
+		auto result = QImage(pixels, QImage::Format_ARGB32_Premultiplied);
+		result.setDevicePixelRatio(ratio);
+		return result;
+	}
+	return ImageSnapshots().take(pixels, ratio, [&] {
+		return QImage(pixels, QImage::Format_ARGB32_Premultiplied);
+	});
+}
+
+void ReturnSnapshot(QPixmap &&snapshot) {
+	PixmapSnapshots().put(std::move(snapshot));
+}
+
+void ReturnSnapshot(QImage &&snapshot) {
+	ImageSnapshots().put(std::move(snapshot));
+}
+
 QPixmap GrabOpaque(not_null<QWidget*> target, QRect rect, QColor bg) {
 	SendPendingMoveResizeEvents(target);
 	if (rect.isNull()) {
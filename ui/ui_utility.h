@@ -75,6 +75,15 @@ void SendPendingMoveResizeEvents(not_null<QWidget*> target);
 	QRect rect = QRect(),
 	QColor bg = QColor(255, 255, 255, 0));
 
+// Image for a custom grab of the given size, with undefined contents,
+// from the same buffers as GrabWidgetToImage() uses.
+[[nodiscard]] QImage TakeSnapshotImage(QSize size);
+
+// Gives a buffer from GrabWidget() / GrabWidgetToImage() back when it
+// is not needed anymore, so that the next grab of the same size reuses it.
+void ReturnSnapshot(QPixmap &&snapshot);
+void ReturnSnapshot(QImage &&snapshot);
+
 [[nodiscard]] QPixmap GrabOpaque(
 	not_null<QWidget*> target,
 	QRect rect,
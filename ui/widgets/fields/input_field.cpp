@@ -1734,6 +1734,83 @@ void InsertCustomEmojiAtCursor(
 	return result;
 }
 
+struct InstantReplaces::Compiled {
+	struct Edge {
+		QChar key;
+		int node = 0;
+	};
+	struct Node {
+		int firstEdge = 0;
+		int edges = 0;
+		int text = -1;
+	};
+
+	[[nodiscard]] const Node *child(const Node &node, QChar key) const {
+		const auto from = edges.data() + node.firstEdge;
+		const auto till = from + node.edges;
+		const auto i = std::lower_bound(from, till, key, [](
+				const Edge &edge,
+				QChar key) {
+			return edge.key < key;
+		});
+		return (i != till && i->key == key) ? &nodes[i->node] : nullptr;
+	}
+
+	std::vector<Node> nodes;
+	std::vector<Edge> edges;
+	std::vector<QString> texts;
+};
+
+namespace {
+
+using CompiledEntries = std::vector<std::pair<QString, QString>>;
+
+// Entries are sorted by the reversed key, so each node is a range of
+// entries sharing the first depth characters, its own entry goes first.
+int CompileInstantReplaces(
+		InstantReplaces::Compiled &result,
+		const CompiledEntries &entries,
+		int from,
+		int till,
+		int depth) {
+	const auto index = int(result.nodes.size());
+	result.nodes.emplace_back();
+	if (from < till && entries[from].first.size() == depth) {
+		result.nodes[index].text = int(result.texts.size());
+		result.texts.push_back(entries[from].second);
+		++from;
+	}
+	auto groups = std::vector<std::pair<int, int>>();
+	for (auto i = from; i != till;) {
+		const auto key = entries[i].first[depth];
+		auto j = i + 1;
+		while (j != till && entries[j].first[depth] == key) {
+			++j;
+		}
+		groups.emplace_back(i, j);
+		i = j;
+	}
+	const auto firstEdge = int(result.edges.size());
+	result.nodes[index].firstEdge = firstEdge;
+	result.nodes[index].edges = int(groups.size());
+	result.edges.resize(firstEdge + groups.size());
+	for (auto k = 0, count = int(groups.size()); k != count; ++k) {
+		const auto &[first, last] = groups[k];
+		result.edges[firstEdge + k] = {
+			.key = entries[first].first[depth],
+			.node = CompileInstantReplaces(
+				result,
+				entries,
+				first,
+				last,
+				depth + 1),
+		};
+	}
+	return index;
+}
+
+} // namespace
+
 void InstantReplaces::add(const QString &what, const QString &with) {
 	auto node = &reverseMap;
 	for (auto i = what.end(), b = what.begin(); i != b;) {
@@ -1743,30 +1820,108 @@ void InstantReplaces::add(const QString &what, const QString &with) {
 	accumulate_max(maxLength, int(what.size()));
 }
 
+bool InstantReplaces::mayEndWith(QChar last) const {
+	return reverseMap.tail.contains(last)
+		|| (compiled
+			&& compiled->child(compiled->nodes.front(), last) != nullptr);
+}
+
+InstantReplaces::Found InstantReplaces::find(
+		QStringView typed,
+		QChar last) const {
+	auto result = Found();
+	const auto size = int(typed.size());
+	const auto at = [&](int length) {
+		return (length == 1) ? last : typed[size - length + 1];
+	};
+	auto limit = size + 1;
+	if (!reverseMap.tail.empty()) {
+		auto node = &reverseMap;
+		for (auto length = 1; length <= limit; ++length) {
+			const auto i = node->tail.find(at(length));
+			if (i == end(node->tail)) {
+				break;
+			}
+			node = &i->second;
+			if (!node->text.isEmpty()) {
+				result = { node->text, length };
+				limit = length - 1;
+				break;
+			}
+		}
+	}
+	if (compiled) {
+		auto node = &compiled->nodes.front();
+		for (auto length = 1; length <= limit; ++length) {
+			node = compiled->child(*node, at(length));
+			if (!node) {
+				break;
+			} else if (node->text >= 0) {
+				result = { compiled->texts[node->text], length };
+				break;
+			}
+		}
+	}
+	return result;
+}
+
+InstantReplaces InstantReplaces::Compile(
+		std::vector<std::pair<QString, QString>> list) {
+	auto result = InstantReplaces();
+	for (auto &[what, with] : list) {
+		accumulate_max(result.maxLength, int(what.size()));
+		std::reverse(what.begin(), what.end());
+	}
+
+	// Like with add(), the last replacement of the same text wins.
+	std::stable_sort(begin(list), end(list), [](
+			const auto &a,
+			const auto &b) {
+		return a.first < b.first;
+	});
+	auto entries = CompiledEntries();
+	entries.reserve(list.size());
+	for (auto &entry : list) {
+		if (entry.first.isEmpty()) {
+			continue;
+		} else if (!entries.empty() && entries.back().first == entry.first) {
+			entries.back().second = std::move(entry.second);
+		} else {
+			entries.push_back(std::move(entry));
+		}
+	}
+	auto compiled = std::make_shared<Compiled>();
+	compiled->texts.reserve(entries.size());
+	CompileInstantReplaces(*compiled, entries, 0, int(entries.size()), 0);
+	result.compiled = std::move(compiled);
+	return result;
+}
+
 const InstantReplaces &InstantReplaces::Default() {
 	static const auto result = [] {
-		auto result = InstantReplaces();
-		result.add("--", QString(1, QChar(8212)));
-		result.add("<<", QString(1, QChar(171)));
-		result.add(">>", QString(1, QChar(187)));
-		result.add(
+		auto list = std::vector<std::pair<QString, QString>>();
+		list.emplace_back("--", QString(1, QChar(8212)));
+		list.emplace_back("<<", QString(1, QChar(171)));
+		list.emplace_back(">>", QString(1, QChar(187)));
+		list.emplace_back(
 			":shrug:",
 			QChar(175) + QString("\\_(") + QChar(12484) + ")_/" + QChar(175));
-		result.add(":o ", QString(1, QChar(0xD83D)) + QChar(0xDE28));
-		result.add("xD ", QString(1, QChar(0xD83D)) + QChar(0xDE06));
+		list.emplace_back(":o ", QString(1, QChar(0xD83D)) + QChar(0xDE28));
+		list.emplace_back("xD ", QString(1, QChar(0xD83D)) + QChar(0xDE06));
 		const auto &replacements = Emoji::internal::GetAllReplacements();
+		const auto &pairs = Emoji::internal::GetReplacementPairs();
+		list.reserve(list.size() + replacements.size() + pairs.size());
 		for (const auto &one : replacements) {
 			const auto with = Emoji::QStringFromUTF16(one.emoji);
 			const auto what = Emoji::QStringFromUTF16(one.replacement);
-			result.add(what, with);
+			list.emplace_back(what, with);
 		}
-		const auto &pairs = Emoji::internal::GetReplacementPairs();
 		for (const auto &[what, index] : pairs) {
 			const auto emoji = Emoji::internal::ByIndex(index);
 			Assert(emoji != nullptr);
-			result.add(what, emoji->text());
+			list.emplace_back(what, emoji->text());
 		}
-		return result;
+		return Compile(std::move(list));
 	}();
 	return result;
 }
@@ -4950,8 +5105,7 @@ void InputField::processInstantReplaces(const QString &appended) {
 		|| !replaces.maxLength) {
 		return;
 	}
-	const auto it = replaces.reverseMap.tail.find(appended[0]);
-	if (it == end(replaces.reverseMap.tail)) {
+	if (!replaces.mayEndWith(appended[0])) {
 		return;
 	}
 	const auto position = textCursor().position();
@@ -4965,21 +5119,12 @@ void InputField::processInstantReplaces(const QString &appended) {
 	const auto typed = getTextWithTagsPart(
 		std::max(position - replaces.maxLength, 0),
 		position - 1).text;
-	auto node = &it->second;
-	auto i = typed.size();
-	do {
-		if (!node->text.isEmpty()) {
-			applyInstantReplace(typed.mid(i) + appended, node->text);
-			return;
-		} else if (!i) {
-			return;
-		}
-		const auto it = node->tail.find(typed[--i]);
-		if (it == end(node->tail)) {
-			return;
-		}
-		node = &it->second;
-	} while (true);
+	const auto found = replaces.find(typed, appended[0]);
+	if (found.length > 0) {
+		applyInstantReplace(
+			typed.mid(typed.size() - (found.length - 1)) + appended,
+			found.with);
+	}
 }
 
 void InputField::processSystemTextReplaces(const QString &appended) {
@@ -6096,8 +6241,11 @@ void InputField::insertFromMimeDataInner(const QMimeData *source) {
 			return result;
 		}
 		if (source->hasHtml() && !_markdownEnabledState.disabled()) {
-			if (auto parsed = TextUtilities::TextWithTagsFromHtml(
-					source->html(),
+			const auto html = source->html();
+			if (!TextUtilities::ScanHtmlFeatures(html).mayHaveTags()) {
+				return plainText();
+			} else if (auto parsed = TextUtilities::TextWithTagsFromHtml(
+					html,
 					_instantViewEditorTagsEnabled)) {
 				if (!HtmlTextMatchesPlainTextStart(
 						parsed->text,
@@ -55,18 +55,37 @@ void InsertCustomEmojiAtCursor(
 	const QString &link);
 
 struct InstantReplaces {
-	struct Node {
-		QString text;
-		std::map<QChar, Node> tail;
+	struct Compiled;
+	struct Found {
+		QString with;
+		int length = 0;
 	};
 
 	void add(const QString &what, const QString &with);
 
+	// Looks for a replacement of typed + last, the shortest one wins.
+	[[nodiscard]] bool mayEndWith(QChar last) const;
+	[[nodiscard]] Found find(QStringView typed, QChar last) const;
+
+	// Builds an immutable flattened trie, copies share it.
+	// Entries added later with add() override the compiled ones.
+	[[nodiscard]] static InstantReplaces Compile(
+		std::vector<std::pair<QString, QString>> list);
+
 	static const InstantReplaces &Default();
 	static const InstantReplaces &TextOnly();
 
 	int maxLength = 0;
+
+private:
+	struct Node {
+		QString text;
+		std::map<QChar, Node> tail;
+	};
+
+	// Only the entries added with add(), the rest are in compiled.
 	Node reverseMap;
+	std::shared_ptr<const Compiled> compiled;
 
 };
 
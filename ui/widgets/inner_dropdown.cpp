@@ -123,7 +123,7 @@ void InnerDropdown::paintEvent(QPaintEvent *e) {
 		_showAnimation.reset();
 		showChildren();
 	} else {
-		if (!_cache.isNull()) _cache = QPixmap();
+		if (!_cache.isNull()) ReturnSnapshot(base::take(_cache));
 		const auto inner = rect().marginsRemoved(_st.padding);
 		Shadow::paint(p, inner, width(), _st.shadow);
 		_roundRect.paint(p, inner);
@@ -253,7 +253,7 @@ void InnerDropdown::maybeReturnFocus() {
 void InnerDropdown::hideFinished() {
 	_a_show.stop();
 	_showAnimation.reset();
-	_cache = QPixmap();
+	ReturnSnapshot(base::take(_cache));
 	_ignoreShowEvents = false;
 	if (!isHidden()) {
 		const auto weak = base::make_weak(this);
@@ -344,9 +344,7 @@ void InnerDropdown::startShowAnimation() {
 
 QImage InnerDropdown::grabForPanelAnimation() {
 	SendPendingMoveResizeEvents(this);
-	const auto pixelRatio = style::DevicePixelRatio();
-	auto result = QImage(size() * pixelRatio, QImage::Format_ARGB32_Premultiplied);
-	result.setDevicePixelRatio(pixelRatio);
+	auto result = TakeSnapshotImage(size());
 	result.fill(Qt::transparent);
 	{
 		QPainter p(&result);
@@ -766,7 +766,7 @@ void PopupMenu::hideFast() {
 void PopupMenu::hideFinished() {
 	_hiding = false;
 	_a_show.stop();
-	_cache = QPixmap();
+	ReturnSnapshot(base::take(_cache));
 	_animatePhase = AnimatePhase::Hidden;
 	if (!isHidden()) {
 		hide();
@@ -890,9 +890,7 @@ void PopupMenu::showAnimationCallback() {
 
 QImage PopupMenu::grabForPanelAnimation() {
 	SendPendingMoveResizeEvents(this);
-	const auto pixelRatio = style::DevicePixelRatio();
-	auto result = QImage(size() * pixelRatio, QImage::Format_ARGB32_Premultiplied);
-	result.setDevicePixelRatio(pixelRatio);
+	auto result = TakeSnapshotImage(size());
 	result.fill(Qt::transparent);
 	{
 		QPainter p(&result);
@@ -936,7 +934,7 @@ void PopupMenu::popup(const QPoint &p) {
 	_hiding = false;
 	_a_opacity.stop();
 	_a_show.stop();
-	_cache = QPixmap();
+	ReturnSnapshot(base::take(_cache));
 	hide();
 	if (_deleteOnHide) {
 		deleteLater();
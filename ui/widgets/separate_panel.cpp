@@ -1160,7 +1160,7 @@ void SeparatePanel::opacityCallback() {
 }
 
 void SeparatePanel::finishAnimating() {
-	_animationCache = QPixmap();
+	ReturnSnapshot(base::take(_animationCache));
 	if (_visible) {
 		showControls();
 		if (_inner) {
@@ -1226,7 +1226,7 @@ void SeparatePanel::hideForStacking() {
 	}
 	_opacityAnimation.stop();
 	_visible = false;
-	_animationCache = QPixmap();
+	ReturnSnapshot(base::take(_animationCache));
 	hide();
 }
 
@@ -358,7 +358,7 @@ void ImportantTooltip::toggleFast(bool visible) {
 
 void ImportantTooltip::checkAnimationFinish() {
 	if (!_visibleAnimation.animating()) {
-		_cache = QPixmap();
+		ReturnSnapshot(base::take(_cache));
 		showChildren();
 		setVisible(_visible);
 		if (_visible) {